@@ -0,0 +1,346 @@
+// Host-side benchmarks for lib/string.c, lib/printfmt.c and
+// lib/readline.c; see bench/Makefrag.
+//
+//	bench-host [baseline]
+//
+// Prints one line per measurement:
+//
+//	name size align ns/op MB/s
+//
+// 'align' is the misalignment of the buffers (for two-buffer routines,
+// destination and source as dst/src), and 'ns/op' is the best of
+// BENCH_ROUNDS rounds.  Lines starting with '#' are comments.  Given
+// the report of an earlier run, it adds the change in ns/op against
+// it as a sixth column, so regressions stand out.
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <cpuid.h>
+
+// For the CPUID_FEATURE_* numbering.  The C library already has the
+// types, so keep out inc/types.h, whose off_t etc. differ.
+#define JOS_INC_TYPES_H
+#include <inc/cpuid.h>
+
+#define BENCH_ROUNDS	5
+#define BENCH_MIN_NS	2000000		// length of one round
+#define BENCH_BUFSIZE	(1 << 20)
+
+// lib/, with the jos_ prefix from bench/Makefrag.
+int	jos_strlen(const char *s);
+void *	jos_memset(void *dst, int c, size_t len);
+void *	jos_memcpy(void *dst, const void *src, size_t len);
+void *	jos_memmove(void *dst, const void *src, size_t len);
+int	jos_memcmp(const void *s1, const void *s2, size_t len);
+void	jos_string_init(void);
+int	jos_snprintf(char *str, int size, const char *fmt, ...);
+char *	jos_readline(const char *prompt);
+
+// What lib/ needs from the kernel.
+
+bool
+jos_cpuid_has_feature(unsigned int bit)
+{
+	unsigned int r[4] = {0}, word = bit / 32;
+
+	switch (word) {
+	case CPUID_1_EDX: case CPUID_1_ECX:
+		__get_cpuid(1, &r[0], &r[1], &r[2], &r[3]);
+		return (word == CPUID_1_EDX ? r[3] : r[2]) >> (bit % 32) & 1;
+	case CPUID_7_EBX:
+		__get_cpuid_count(7, 0, &r[0], &r[1], &r[2], &r[3]);
+		return r[1] >> (bit % 32) & 1;
+	case CPUID_80000001_EDX: case CPUID_80000001_ECX:
+		__get_cpuid(0x80000001, &r[0], &r[1], &r[2], &r[3]);
+		return (word == CPUID_80000001_EDX ? r[3] : r[2]) >> (bit % 32) & 1;
+	}
+	return 0;
+}
+
+static const char *input;	// what jos_getchar() returns
+
+int
+jos_getchar(void)
+{
+	if (*input == '\0')
+		return -1;
+	return *input++;
+}
+
+void
+jos_cputchar(int c)
+{
+}
+
+int
+jos_iscons(int fd)
+{
+	return 0;
+}
+
+int
+jos_cprintf(const char *fmt, ...)
+{
+	return 0;
+}
+
+// Timing
+
+static char *buf1, *buf2;
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+struct bench {
+	const char *name;
+	void (*run)(const struct bench *b, size_t size, int dalign, int salign);
+};
+
+// Run 'b' repeatedly for BENCH_MIN_NS, BENCH_ROUNDS times, and return
+// the best time per call in ns.
+static double
+measure(const struct bench *b, size_t size, int dalign, int salign)
+{
+	uint64_t t0, t;
+	double best = 0, ns;
+	long n, iters;
+	int round;
+
+	// Find an iteration count that takes about BENCH_MIN_NS.
+	for (iters = 1; ; iters *= 2) {
+		t0 = now_ns();
+		for (n = 0; n < iters; n++)
+			b->run(b, size, dalign, salign);
+		if ((t = now_ns() - t0) >= BENCH_MIN_NS / 4)
+			break;
+	}
+	iters = iters * 4 * (BENCH_MIN_NS / 4) / (t ? t : 1) + 1;
+
+	for (round = 0; round < BENCH_ROUNDS; round++) {
+		t0 = now_ns();
+		for (n = 0; n < iters; n++)
+			b->run(b, size, dalign, salign);
+		ns = (double) (now_ns() - t0) / iters;
+		if (round == 0 || ns < best)
+			best = ns;
+	}
+	return best;
+}
+
+// Baseline comparison
+
+struct result {
+	char key[128];	// name, size and align; see load_baseline()
+	double ns;
+};
+
+static struct result *baseline;
+static int nbaseline;
+
+static void
+key(char *k, size_t n, const char *name, size_t size, int dalign, int salign)
+{
+	if (salign < 0)
+		snprintf(k, n, "%s %zu %d", name, size, dalign);
+	else
+		snprintf(k, n, "%s %zu %d/%d", name, size, dalign, salign);
+}
+
+static void
+load_baseline(const char *path)
+{
+	FILE *f;
+	char line[256], name[64], size[32], align[32];
+	double ns;
+
+	if ((f = fopen(path, "r")) == NULL) {
+		perror(path);
+		exit(1);
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#'
+		    || sscanf(line, "%63s %31s %31s %lf", name, size, align, &ns) != 4)
+			continue;
+		baseline = realloc(baseline, (nbaseline + 1) * sizeof(*baseline));
+		snprintf(baseline[nbaseline].key, sizeof(baseline[nbaseline].key),
+			 "%s %s %s", name, size, align);
+		baseline[nbaseline].ns = ns;
+		nbaseline++;
+	}
+	fclose(f);
+}
+
+static void
+report(const struct bench *b, size_t size, int dalign, int salign)
+{
+	char k[128];
+	double ns;
+	int i;
+
+	ns = measure(b, size, dalign, salign);
+	key(k, sizeof(k), b->name, size, dalign, salign);
+	printf("%-28s %10.1f %10.1f", k, ns, size ? size * 1e3 / ns : 0.0);
+	for (i = 0; i < nbaseline; i++)
+		if (strcmp(baseline[i].key, k) == 0) {
+			printf(" %+7.1f%%", (ns - baseline[i].ns) * 100 / baseline[i].ns);
+			break;
+		}
+	printf("\n");
+	fflush(stdout);
+}
+
+// Benchmarks
+
+static volatile int sink;
+
+static void
+run_memset(const struct bench *b, size_t size, int dalign, int salign)
+{
+	jos_memset(buf1 + dalign, 0x5a, size);
+}
+
+static void
+run_memcpy(const struct bench *b, size_t size, int dalign, int salign)
+{
+	jos_memcpy(buf1 + dalign, buf2 + salign, size);
+}
+
+static void
+run_memmove(const struct bench *b, size_t size, int dalign, int salign)
+{
+	jos_memmove(buf1 + dalign, buf2 + salign, size);
+}
+
+// Overlapping, so memmove has to copy backward.
+static void
+run_memmove_back(const struct bench *b, size_t size, int dalign, int salign)
+{
+	jos_memmove(buf1 + 64 + dalign, buf1 + salign, size);
+}
+
+static void
+run_memcmp(const struct bench *b, size_t size, int dalign, int salign)
+{
+	sink = jos_memcmp(buf1 + dalign, buf2 + salign, size);
+}
+
+static void
+run_strlen(const struct bench *b, size_t size, int dalign, int salign)
+{
+	sink = jos_strlen(buf2 + dalign);
+}
+
+static const struct bench mem_benches[] = {
+	{ "memset", run_memset },
+	{ "memcpy", run_memcpy },
+	{ "memmove", run_memmove },
+	{ "memmove-back", run_memmove_back },
+	{ "memcmp", run_memcmp },
+};
+
+// One benchmark per format, so that picking the format isn't timed.
+#define SNPRINTF_BENCH(name, ...)					\
+static void								\
+run_snprintf_##name(const struct bench *b, size_t size, int dalign, int salign) \
+{									\
+	char out[128];							\
+									\
+	sink = jos_snprintf(out, sizeof(out), __VA_ARGS__);		\
+}
+
+SNPRINTF_BENCH(literal, "the quick brown fox\n")
+SNPRINTF_BENCH(d, "%d", -123456789)
+SNPRINTF_BENCH(u, "%u", 4000000000U)
+SNPRINTF_BENCH(x, "%08x", 0xdeadbeef)
+SNPRINTF_BENCH(llu, "%llu", 18446744073709551615ULL)
+SNPRINTF_BENCH(s, "%-16s|", "kern/monitor.c")
+SNPRINTF_BENCH(mixed, "  %08x  %s:%d: %.*s+%d\n",
+	       0xf0100000, "kern/init.c", 42, 9, "i386_init", 27)
+
+static const struct bench fmt_benches[] = {
+	{ "snprintf-literal", run_snprintf_literal },
+	{ "snprintf-d", run_snprintf_d },
+	{ "snprintf-u", run_snprintf_u },
+	{ "snprintf-x", run_snprintf_x },
+	{ "snprintf-llu", run_snprintf_llu },
+	{ "snprintf-s", run_snprintf_s },
+	{ "snprintf-mixed", run_snprintf_mixed },
+};
+
+static void
+run_readline(const struct bench *b, size_t size, int dalign, int salign)
+{
+	input = buf2 + dalign;
+	sink = jos_readline(NULL) != NULL;
+}
+
+static const struct bench readline_bench = { "readline", run_readline };
+
+int
+main(int argc, char **argv)
+{
+	static const size_t mem_sizes[] = { 8, 64, 512, 4096, 65536, 1 << 20 };
+	static const int aligns[][2] = { {0, 0}, {1, 0}, {0, 3}, {1, 3} };
+	static const size_t str_sizes[] = { 8, 64, 512, 4096 };
+	size_t i, j, k;
+
+	if (argc > 2) {
+		fprintf(stderr, "Usage: bench-host [baseline]\n");
+		exit(2);
+	}
+	if (argc == 2)
+		load_baseline(argv[1]);
+
+	// Leave room for misalignment and memmove-back's offset.
+	buf1 = aligned_alloc(4096, BENCH_BUFSIZE + 4096);
+	buf2 = aligned_alloc(4096, BENCH_BUFSIZE + 4096);
+	if (buf1 == NULL || buf2 == NULL) {
+		perror("aligned_alloc");
+		exit(1);
+	}
+	memset(buf1, 'a', BENCH_BUFSIZE + 4096);
+	memset(buf2, 'a', BENCH_BUFSIZE + 4096);
+
+	jos_string_init();
+	printf("# bench-host: erms %d sse2 %d\n",
+	       jos_cpuid_has_feature(CPUID_FEATURE_ERMS),
+	       jos_cpuid_has_feature(CPUID_FEATURE_SSE2));
+	printf("# name size align ns/op MB/s [change]\n");
+
+	for (i = 0; i < sizeof(mem_benches) / sizeof(mem_benches[0]); i++)
+		for (j = 0; j < sizeof(mem_sizes) / sizeof(mem_sizes[0]); j++)
+			for (k = 0; k < sizeof(aligns) / sizeof(aligns[0]); k++)
+				report(&mem_benches[i], mem_sizes[j],
+				       aligns[k][0], aligns[k][1]);
+
+	for (j = 0; j < sizeof(str_sizes) / sizeof(str_sizes[0]); j++)
+		for (k = 0; k < 4; k++) {
+			static const struct bench strlen_bench = { "strlen", run_strlen };
+
+			buf2[k + str_sizes[j]] = '\0';
+			report(&strlen_bench, str_sizes[j], k, -1);
+			buf2[k + str_sizes[j]] = 'a';
+		}
+
+	for (i = 0; i < sizeof(fmt_benches) / sizeof(fmt_benches[0]); i++)
+		report(&fmt_benches[i], 0, 0, -1);
+
+	// One 80-character line.
+	buf2[80] = '\n';
+	buf2[81] = '\0';
+	report(&readline_bench, 81, 0, -1);
+	buf2[80] = buf2[81] = 'a';
+
+	return 0;
+}
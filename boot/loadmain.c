@@ -0,0 +1,425 @@
+#include <inc/x86.h>
+#include <inc/elf.h>
+#include <inc/multiboot.h>
+#include <inc/lzimg.h>
+#include <inc/boottime.h>
+
+/**********************************************************************
+ * The second-stage loader, whose job is to load the ELF kernel image
+ * from the first IDE hard disk as fast as the controller allows.
+ *
+ * DISK LAYOUT
+ *  * Sector 0 holds the boot sector (boot.S and main.c).
+ *
+ *  * Sectors 1 to KERN_SECT-1 hold this loader (loader.S and
+ *    loadmain.c), itself an ELF image that the boot sector loads.
+ *
+ *  * Sector KERN_SECT onward holds the kernel image.
+ *
+ * Where the PCI bus has a PIIX-style IDE controller with bus-master
+ * DMA (as QEMU's piix4-ide does), we program its DMA engine to copy
+ * each ELF segment straight to its load address.  Otherwise, or if a
+ * DMA transfer fails, we fall back to PIO with READ MULTIPLE, which
+ * the boot sector has already enabled.
+ *
+ * The kernel image is either the kernel ELF file itself or, when built
+ * with KERN_LZ=1, a compressed image made by mklzimg (see inc/lzimg.h).
+ * We read each compressed segment into scratch memory just past its
+ * load address and decompress it into place.
+ *
+ * We also keep the boot-phase timestamps that boot.S started at
+ * BOOTTIME_PADDR and pass them to the kernel (see inc/boottime.h).
+ *
+ * Like the boot sector, we run with paging off and an identity segment
+ * mapping, so pointers are physical addresses.  Note that the boot
+ * sector doesn't clear our bss.
+ **********************************************************************/
+
+#define SECTSIZE	512
+#define MULTSECTS	16	// sectors per READ MULTIPLE data block
+#define MAXSECTS	128	// sectors per command
+#define ELFHDR		((struct Elf *) 0x10000) // scratch space
+#define LZHDR		((struct Lzimg *) ELFHDR)
+
+// ATA command block registers on the primary channel
+#define IDE_DATA	0x1F0
+#define IDE_NSECT	0x1F2
+#define IDE_LBA0	0x1F3
+#define IDE_LBA1	0x1F4
+#define IDE_LBA2	0x1F5
+#define IDE_DEV		0x1F6
+#define IDE_CMD		0x1F7	// Out: command
+#define IDE_STATUS	0x1F7	// In:	status
+#define   IDE_ERR	0x01	//   Error
+#define   IDE_DF	0x20	//   Device fault
+#define   IDE_DRDY	0x40	//   Device ready
+#define   IDE_BSY	0x80	//   Busy
+
+#define ATA_READ_MULTIPLE	0xC4
+#define ATA_READ_DMA		0xC8
+
+// PCI configuration space access
+#define PCI_CONF_ADDR	0xCF8
+#define PCI_CONF_DATA	0xCFC
+#define PCI_ID		0x00	// Device and vendor ID
+#define PCI_CMD		0x04	// Status and command
+#define   PCI_CMD_IO	0x0001	//   I/O space enable
+#define   PCI_CMD_MASTER 0x0004	//   Bus master enable
+#define PCI_CLASS	0x08	// Class, subclass, prog-if, and revision
+#define PCI_BAR4	0x20	// Bus master IDE I/O base
+
+// Bus master IDE registers, relative to BAR4, primary channel
+#define BM_CMD		0	// Command
+#define   BM_CMD_START	0x01	//   Start bus master operation
+#define   BM_CMD_READ	0x08	//   Transfer from disk to memory
+#define BM_STATUS	2	// Status
+#define   BM_STATUS_ACT	0x01	//   Bus master active
+#define   BM_STATUS_ERR	0x02	//   Error (write 1 to clear)
+#define   BM_STATUS_INTR 0x04	//   Interrupt (write 1 to clear)
+#define BM_PRDT		4	// Physical region descriptor table address
+
+// Give up on a DMA transfer after this many status polls.
+#define BM_TIMEOUT	(1 << 24)
+
+// A physical region descriptor: one contiguous chunk of a DMA transfer.
+// A chunk must not cross a 64KB boundary; a length of 0 means 64KB.
+struct prd {
+	uint32_t addr;
+	uint16_t len;
+	uint16_t flags;
+#define PRD_EOT		0x8000	// Last entry in the table
+};
+
+// MAXSECTS sectors span at most two 64KB-bounded chunks.  Aligning the
+// table to its size keeps it from crossing a 64KB boundary itself.
+static struct prd prdt[2] __attribute__((aligned(sizeof(struct prd) * 2)));
+
+// I/O base of the bus master registers, or 0 to use PIO
+static uint32_t bmiba;
+
+static void ide_dma_init(void);
+static void readseg(uint32_t, uint32_t, uint32_t);
+static void lz4_decode(uint8_t *, const uint8_t *, uint32_t);
+static void zero(uint32_t, uint32_t);
+static void boottime_init(void);
+static void stamp(uint32_t, uint32_t);
+
+void
+loadmain(uint32_t magic, struct multiboot_info *mbi)
+{
+	struct Proghdr *ph, *eph;
+	struct Lzseg *zs, *ezs;
+	uint32_t entry, scratch, i;
+
+	boottime_init();
+	ide_dma_init();
+
+	// read 1st page off disk
+	readseg((uint32_t) ELFHDR, SECTSIZE*8, 0);
+
+	if (ELFHDR->e_magic == ELF_MAGIC) {
+		// load each program segment (ignores ph flags)
+		ph = (struct Proghdr *) ((uint8_t *) ELFHDR + ELFHDR->e_phoff);
+		eph = ph + ELFHDR->e_phnum;
+		for (i = 0; ph < eph; ph++, i++) {
+			// p_pa is the load address of this segment (as well
+			// as the physical address).  Only p_filesz bytes come
+			// from the disk; the rest is bss.
+			stamp(BOOTTIME_SEG_BEGIN, i);
+			readseg(ph->p_pa, ph->p_filesz, ph->p_offset);
+			zero(ph->p_pa + ph->p_filesz, ph->p_memsz - ph->p_filesz);
+			stamp(BOOTTIME_SEG_END, i);
+		}
+		entry = ELFHDR->e_entry;
+	} else if (LZHDR->z_magic == LZIMG_MAGIC) {
+		// load and decompress each segment, in increasing order,
+		// so a segment's scratch space is free until we reach the
+		// next one
+		zs = (struct Lzseg *) (LZHDR + 1);
+		ezs = zs + LZHDR->z_nseg;
+		entry = LZHDR->z_entry;
+		for (i = 0; zs < ezs; zs++, i++) {
+			stamp(BOOTTIME_SEG_BEGIN, i);
+			scratch = ROUNDUP(zs->s_pa + zs->s_memsz, LZIMG_ALIGN);
+			readseg(scratch, zs->s_csize, zs->s_offset);
+			lz4_decode((uint8_t *) zs->s_pa, (uint8_t *) scratch,
+				   zs->s_csize);
+			zero(zs->s_pa + zs->s_filesz, zs->s_memsz - zs->s_filesz);
+			stamp(BOOTTIME_SEG_END, i);
+		}
+	} else
+		goto bad;
+
+	// The kernel need not clear its bss again.
+	mbi->flags |= MULTIBOOT_INFO_JOS_BSS;
+
+	// Hand over the boot-phase timestamps.
+	stamp(BOOTTIME_KERNEL, 0);
+	mbi->flags |= MULTIBOOT_INFO_JOS_BOOTTIME;
+	mbi->jos_boottime = BOOTTIME_PADDR;
+
+	// Pass the Multiboot state the boot sector gave us on to the
+	// kernel: magic in eax, multiboot_info in ebx.
+	asm ("movl %0, %%eax;"
+	     "movl %1, %%ebx;"
+		: : "r"(magic), "r"(mbi)
+		: "eax", "ebx");
+
+	// call the entry point from the image header
+	// note: does not return!
+	((void (*)(void)) entry)();
+
+bad:
+	while (1)
+		/* do nothing */;
+}
+
+static uint32_t
+pci_conf_read(uint32_t dev, uint32_t off)
+{
+	outl(PCI_CONF_ADDR, 0x80000000 | dev | off);
+	return inl(PCI_CONF_DATA);
+}
+
+static void
+pci_conf_write(uint32_t dev, uint32_t off, uint32_t v)
+{
+	outl(PCI_CONF_ADDR, 0x80000000 | dev | off);
+	outl(PCI_CONF_DATA, v);
+}
+
+// Look for an IDE controller on PCI bus 0 whose primary channel is in
+// compatibility mode (so it's the one at 0x1F0) and that can do bus
+// master DMA.  If there is one, enable bus mastering and set bmiba.
+static void
+ide_dma_init(void)
+{
+	uint32_t dev, class, bar;
+
+	bmiba = 0;
+	// dev holds the device and function number fields of the
+	// configuration address (bits 15-8).
+	for (dev = 0; dev < 0x10000; dev += 0x100) {
+		if ((pci_conf_read(dev, PCI_ID) & 0xFFFF) == 0xFFFF)
+			continue;
+		class = pci_conf_read(dev, PCI_CLASS);
+		// Mass storage (0x01), IDE (0x01), primary channel not
+		// in native mode (prog-if bit 0), bus master (bit 7).
+		if ((class >> 16) != 0x0101 || (class & 0x8100) != 0x8000)
+			continue;
+		bar = pci_conf_read(dev, PCI_BAR4);
+		if (!(bar & 1) || !(bar & ~3))
+			continue;
+		pci_conf_write(dev, PCI_CMD, (pci_conf_read(dev, PCI_CMD) & 0xFFFF)
+			       | PCI_CMD_IO | PCI_CMD_MASTER);
+		bmiba = bar & ~3;
+		return;
+	}
+}
+
+static void
+waitdisk(void)
+{
+	// wait for disk ready
+	while ((inb(IDE_STATUS) & (IDE_BSY|IDE_DRDY)) != IDE_DRDY)
+		/* do nothing */;
+}
+
+static void
+ide_cmd(uint32_t offset, uint32_t nsect, uint8_t cmd)
+{
+	// wait for disk to be ready
+	waitdisk();
+
+	outb(IDE_NSECT, nsect);
+	outb(IDE_LBA0, offset);
+	outb(IDE_LBA1, offset >> 8);
+	outb(IDE_LBA2, offset >> 16);
+	outb(IDE_DEV, (offset >> 24) | 0xE0);
+	outb(IDE_CMD, cmd);
+}
+
+// Read 'nsect' sectors starting at 'offset' into 'dst' using DMA.
+// Return 0 on success, -1 if the transfer failed.
+static int
+readsect_dma(uint32_t dst, uint32_t offset, uint32_t nsect)
+{
+	uint32_t len, n, i;
+	uint8_t status;
+
+	// Split the buffer into chunks at 64KB boundaries.
+	for (len = nsect * SECTSIZE, i = 0; len > 0; len -= n, dst += n, i++) {
+		n = 0x10000 - (dst & 0xFFFF);
+		if (n > len)
+			n = len;
+		prdt[i].addr = dst;
+		prdt[i].len = n;
+		prdt[i].flags = 0;
+	}
+	prdt[i - 1].flags = PRD_EOT;
+
+	outb(bmiba + BM_CMD, 0);
+	outl(bmiba + BM_PRDT, (uint32_t) prdt);
+	outb(bmiba + BM_STATUS, BM_STATUS_ERR | BM_STATUS_INTR);
+	outb(bmiba + BM_CMD, BM_CMD_READ);
+
+	ide_cmd(offset, nsect, ATA_READ_DMA);
+	outb(bmiba + BM_CMD, BM_CMD_READ | BM_CMD_START);
+
+	// The drive raises its interrupt when the transfer is done.
+	for (i = 0; i < BM_TIMEOUT; i++) {
+		status = inb(bmiba + BM_STATUS);
+		if (status & (BM_STATUS_ERR | BM_STATUS_INTR))
+			break;
+	}
+	outb(bmiba + BM_CMD, 0);
+
+	// Reading the status register also acknowledges the interrupt.
+	if (i == BM_TIMEOUT || (status & BM_STATUS_ERR)
+	    || (inb(IDE_STATUS) & (IDE_ERR | IDE_DF)))
+		return -1;
+	return 0;
+}
+
+// Read 'nsect' sectors, a multiple of MULTSECTS, starting at 'offset'
+// into 'dst' using PIO.
+static void
+readsect_pio(uint32_t dst, uint32_t offset, uint32_t nsect)
+{
+	ide_cmd(offset, nsect, ATA_READ_MULTIPLE);
+
+	for (; nsect > 0; nsect -= MULTSECTS) {
+		// wait for disk to be ready
+		waitdisk();
+
+		// read a block of MULTSECTS sectors
+		insl(IDE_DATA, (void *) dst, MULTSECTS * SECTSIZE / 4);
+		dst += MULTSECTS * SECTSIZE;
+	}
+}
+
+// Read 'count' bytes at 'offset' from kernel into physical address 'pa'.
+// Might copy more than asked
+static void
+readseg(uint32_t pa, uint32_t count, uint32_t offset)
+{
+	uint32_t end_pa, nsect;
+
+	end_pa = pa + count;
+
+	// round down to sector boundary
+	pa &= ~(SECTSIZE - 1);
+
+	// translate from bytes to sectors; kernel starts at KERN_SECT
+	offset = (offset / SECTSIZE) + KERN_SECT;
+
+	// Read up to MAXSECTS sectors per command, in whole READ MULTIPLE
+	// blocks so that PIO can take over at any point.  We'd write more
+	// to memory than asked, but it doesn't matter -- we load in
+	// increasing order.
+	while (pa < end_pa) {
+		nsect = ROUNDUP(end_pa - pa, SECTSIZE * MULTSECTS) / SECTSIZE;
+		if (nsect > MAXSECTS)
+			nsect = MAXSECTS;
+		if (!bmiba || readsect_dma(pa, offset, nsect) < 0) {
+			bmiba = 0;
+			readsect_pio(pa, offset, nsect);
+		}
+		pa += nsect * SECTSIZE;
+		offset += nsect;
+	}
+}
+
+// Zero 'n' bytes at physical address 'pa': whole words, then the rest.
+static void
+zero(uint32_t pa, uint32_t n)
+{
+	uint32_t words = n / 4, bytes = n % 4;
+
+	asm volatile("cld; rep stosl"
+		     : "+D" (pa), "+c" (words) : "a" (0) : "cc", "memory");
+	asm volatile("rep stosb"
+		     : "+D" (pa), "+c" (bytes) : "a" (0) : "cc", "memory");
+}
+
+// Copy 'n' bytes forward, one at a time, so that an LZ4 match may
+// overlap the bytes it produces.
+static uint8_t *
+copy(uint8_t *dst, const uint8_t *src, uint32_t n)
+{
+	asm volatile("cld; rep movsb"
+		     : "+D" (dst), "+S" (src), "+c" (n) : : "cc", "memory");
+	return dst;
+}
+
+// Decode the LZ4 block of 'csize' bytes at 'src' into 'dst'.
+static void
+lz4_decode(uint8_t *dst, const uint8_t *src, uint32_t csize)
+{
+	const uint8_t *end = src + csize;
+	uint32_t token, len, off, b;
+
+	while (src < end) {
+		token = *src++;
+
+		// literals
+		len = token >> 4;
+		if (len == 15)
+			do {
+				len += (b = *src++);
+			} while (b == 255);
+		dst = copy(dst, src, len);
+		src += len;
+
+		// the last sequence has no match
+		if (src >= end)
+			break;
+
+		// match
+		off = src[0] | (src[1] << 8);
+		src += 2;
+		len = token & 15;
+		if (len == 15)
+			do {
+				len += (b = *src++);
+			} while (b == 255);
+		dst = copy(dst, dst - off, len + 4);
+	}
+}
+
+// Complete the two timestamps boot.S took, and take our own first one.
+// boot.S could only store the low 32 bits of the TSC; the high bits are
+// ours, less a carry if the low bits have wrapped since (the boot sector
+// runs for much less than 2^32 cycles).
+static void
+boottime_init(void)
+{
+	struct boottime *bt = (struct boottime *) BOOTTIME_PADDR;
+	uint64_t now = read_tsc();
+	uint32_t lo, hi, i;
+
+	for (i = BOOTTIME_E820_BEGIN; i <= BOOTTIME_E820_END; i++) {
+		lo = bt->entries[i].tsc;
+		hi = (now >> 32) - (lo > (uint32_t) now);
+		bt->entries[i].tsc = ((uint64_t) hi << 32) | lo;
+		bt->entries[i].event = i;
+		bt->entries[i].arg = 0;
+	}
+	bt->nr = BOOTTIME_E820_END + 1;
+	stamp(BOOTTIME_LOADER, 0);
+}
+
+// Record a boot-phase timestamp for 'event'.
+static void
+stamp(uint32_t event, uint32_t arg)
+{
+	struct boottime *bt = (struct boottime *) BOOTTIME_PADDR;
+	struct boottime_entry *e;
+
+	if (bt->nr == BOOTTIME_NR_MAX)
+		return;
+	e = &bt->entries[bt->nr++];
+	e->tsc = read_tsc();
+	e->event = event;
+	e->arg = arg;
+}
@@ -4,15 +4,19 @@
 
 /**********************************************************************
  * This a dirt simple boot loader, whose sole job is to boot
- * an ELF kernel image from the first IDE hard disk.
+ * an ELF image from the first IDE hard disk.  That image is the
+ * second-stage loader (loader.S and loadmain.c), which in turn loads
+ * the kernel.
  *
  * DISK LAYOUT
  *  * This program(boot.S and main.c) is the bootloader.  It should
  *    be stored in the first sector of the disk.
  *
- *  * The 2nd sector onward holds the kernel image.
+ *  * The 2nd sector onward holds the second-stage loader image.
  *
- *  * The kernel image must be in ELF format.
+ *  * Sector KERN_SECT onward holds the kernel image.
+ *
+ *  * Both images must be in ELF format.
  *
  * BOOT UP STEPS
  *  * when the CPU boots it loads the BIOS into memory and executes it
@@ -27,14 +31,17 @@
  *  * control starts in boot.S -- which sets up protected mode,
  *    and a stack so C code then run, then calls bootmain()
  *
- *  * bootmain() in this file takes over, reads in the kernel and jumps to it.
+ *  * bootmain() in this file takes over, reads in the second-stage
+ *    loader and jumps to it.
  **********************************************************************/
 
 #define SECTSIZE	512
+#define MULTSECTS	16	// sectors per READ MULTIPLE command
 #define ELFHDR		((struct Elf *) 0x10000) // scratch space
 
 void readsect(void*, uint32_t);
 void readseg(uint32_t, uint32_t, uint32_t);
+void waitdisk(void);
 
 struct multiboot_info *mbi;
 
@@ -43,6 +50,11 @@ bootmain(void)
 {
 	struct Proghdr *ph, *eph;
 
+	// transfer MULTSECTS sectors per command from now on
+	waitdisk();
+	outb(0x1F2, MULTSECTS);
+	outb(0x1F7, 0xC6);	// cmd 0xC6 - set multiple mode
+
 	// read 1st page off disk
 	readseg((uint32_t) ELFHDR, SECTSIZE*8, 0);
 
@@ -83,7 +95,7 @@ bad:
 		/* do nothing */;
 }
 
-// Read 'count' bytes at 'offset' from kernel into physical address 'pa'.
+// Read 'count' bytes at 'offset' from loader into physical address 'pa'.
 // Might copy more than asked
 void
 readseg(uint32_t pa, uint32_t count, uint32_t offset)
@@ -95,20 +107,19 @@ readseg(uint32_t pa, uint32_t count, uint32_t offset)
 	// round down to sector boundary
 	pa &= ~(SECTSIZE - 1);
 
-	// translate from bytes to sectors, and kernel starts at sector 1
+	// translate from bytes to sectors, and loader starts at sector 1
 	offset = (offset / SECTSIZE) + 1;
 
-	// If this is too slow, we could read lots of sectors at a time.
-	// We'd write more to memory than asked, but it doesn't matter --
-	// we load in increasing order.
+	// Read MULTSECTS sectors at a time.  We'd write more to memory
+	// than asked, but it doesn't matter -- we load in increasing order.
 	while (pa < end_pa) {
 		// Since we haven't enabled paging yet and we're using
 		// an identity segment mapping (see boot.S), we can
 		// use physical addresses directly.  This won't be the
 		// case once JOS enables the MMU.
 		readsect((uint8_t*) pa, offset);
-		pa += SECTSIZE;
-		offset++;
+		pa += SECTSIZE * MULTSECTS;
+		offset += MULTSECTS;
 	}
 }
 
@@ -120,23 +131,26 @@ waitdisk(void)
 		/* do nothing */;
 }
 
+// Read MULTSECTS sectors starting at 'offset' into 'dst'.  Each
+// READ MULTIPLE command moves the whole run in one data block, so
+// there's one command and one status poll per run, not per sector.
 void
 readsect(void *dst, uint32_t offset)
 {
 	// wait for disk to be ready
 	waitdisk();
 
-	outb(0x1F2, 1);		// count = 1
+	outb(0x1F2, MULTSECTS);	// count = MULTSECTS
 	outb(0x1F3, offset);
 	outb(0x1F4, offset >> 8);
 	outb(0x1F5, offset >> 16);
 	outb(0x1F6, (offset >> 24) | 0xE0);
-	outb(0x1F7, 0x20);	// cmd 0x20 - read sectors
+	outb(0x1F7, 0xC4);	// cmd 0xC4 - read multiple
 
 	// wait for disk to be ready
 	waitdisk();
 
-	// read a sector
-	insl(0x1F0, dst, SECTSIZE/4);
+	// read the sectors
+	insl(0x1F0, dst, SECTSIZE * MULTSECTS / 4);
 }
 
@@ -0,0 +1,202 @@
+// Build a compressed kernel image for the second-stage loader.
+//
+//	mklzimg kernel kernel.lz
+//
+// Each loadable segment of the ELF file 'kernel' is compressed into an
+// LZ4 block; see inc/lzimg.h for the image layout.  The compressor is a
+// plain greedy matcher over a hash table of 4-byte sequences: the point
+// is to move fewer sectors over IDE, and decompression speed in the
+// loader matters much more than ratio.
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <inc/elf.h>
+#include <inc/lzimg.h>
+
+#define MINMATCH	4	// shortest match LZ4 can encode
+#define LASTLITERALS	5	// the last 5 bytes are always literals
+#define MFLIMIT		12	// the last match starts this far from the end
+#define MAXOFFSET	65535
+#define HASHBITS	16
+
+static uint8_t *out;
+static size_t outlen, outcap;
+
+static void
+emit(const void *p, size_t n)
+{
+	if (outlen + n > outcap) {
+		outcap = (outlen + n) * 2;
+		if ((out = realloc(out, outcap)) == NULL) {
+			perror("realloc");
+			exit(1);
+		}
+	}
+	memcpy(out + outlen, p, n);
+	outlen += n;
+}
+
+static void
+emit_byte(uint8_t c)
+{
+	emit(&c, 1);
+}
+
+// Emit the extra bytes of a length that didn't fit in its token nibble.
+static void
+emit_len(size_t len)
+{
+	for (len -= 15; len >= 255; len -= 255)
+		emit_byte(255);
+	emit_byte(len);
+}
+
+// Emit one sequence: literals, then (if mlen != 0) a match.
+static void
+emit_seq(const uint8_t *lit, size_t llen, size_t off, size_t mlen)
+{
+	uint8_t token;
+
+	token = (llen < 15 ? llen : 15) << 4;
+	if (mlen)
+		token |= (mlen - MINMATCH < 15 ? mlen - MINMATCH : 15);
+	emit_byte(token);
+	if (llen >= 15)
+		emit_len(llen);
+	emit(lit, llen);
+	if (!mlen)
+		return;
+	emit_byte(off);
+	emit_byte(off >> 8);
+	if (mlen - MINMATCH >= 15)
+		emit_len(mlen - MINMATCH);
+}
+
+static uint32_t
+read32(const uint8_t *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return v;
+}
+
+// Compress 'src' as one LZ4 block, appending it to 'out'.
+static void
+compress(const uint8_t *src, size_t n)
+{
+	static int64_t table[1 << HASHBITS];
+	size_t ip, anchor, mlen, h;
+	int64_t ref;
+
+	for (h = 0; h < (1 << HASHBITS); h++)
+		table[h] = -1;
+
+	ip = anchor = 0;
+	while (n >= MFLIMIT + 1 && ip < n - MFLIMIT) {
+		h = (read32(src + ip) * 2654435761U) >> (32 - HASHBITS);
+		ref = table[h];
+		table[h] = ip;
+		if (ref < 0 || ip - ref > MAXOFFSET
+		    || read32(src + ref) != read32(src + ip)) {
+			ip++;
+			continue;
+		}
+		for (mlen = MINMATCH;
+		     ip + mlen < n - LASTLITERALS && src[ref + mlen] == src[ip + mlen];
+		     mlen++)
+			/* do nothing */;
+		emit_seq(src + anchor, ip - anchor, ip - ref, mlen);
+		ip += mlen;
+		anchor = ip;
+	}
+	emit_seq(src + anchor, n - anchor, 0, 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	FILE *f;
+	uint8_t *elf;
+	long size;
+	struct Elf *eh;
+	struct Proghdr *ph;
+	struct Lzimg z;
+	struct Lzseg seg[(LZIMG_ALIGN - sizeof(struct Lzimg)) / sizeof(struct Lzseg)];
+	size_t i, raw;
+
+	if (argc != 3) {
+		fprintf(stderr, "Usage: mklzimg kernel kernel.lz\n");
+		exit(2);
+	}
+
+	if ((f = fopen(argv[1], "rb")) == NULL) {
+		perror(argv[1]);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	size = ftell(f);
+	rewind(f);
+	if ((elf = malloc(size)) == NULL || fread(elf, 1, size, f) != size) {
+		perror(argv[1]);
+		exit(1);
+	}
+	fclose(f);
+
+	eh = (struct Elf *) elf;
+	if (size < sizeof(*eh) || eh->e_magic != ELF_MAGIC
+	    || eh->e_phoff + eh->e_phnum * sizeof(*ph) > size) {
+		fprintf(stderr, "%s: not an ELF file\n", argv[1]);
+		exit(1);
+	}
+
+	// Leave room for the headers in the first LZIMG_ALIGN bytes.
+	outcap = size;
+	if ((out = calloc(1, outcap)) == NULL) {
+		perror("calloc");
+		exit(1);
+	}
+	outlen = LZIMG_ALIGN;
+
+	z.z_magic = LZIMG_MAGIC;
+	z.z_entry = eh->e_entry;
+	z.z_nseg = 0;
+	raw = 0;
+	ph = (struct Proghdr *) (elf + eh->e_phoff);
+	for (i = 0; i < eh->e_phnum; i++, ph++) {
+		if (ph->p_type != ELF_PROG_LOAD || ph->p_memsz == 0)
+			continue;
+		if (z.z_nseg == sizeof(seg) / sizeof(seg[0])) {
+			fprintf(stderr, "%s: too many segments\n", argv[1]);
+			exit(1);
+		}
+		if (ph->p_offset + ph->p_filesz > size) {
+			fprintf(stderr, "%s: truncated segment\n", argv[1]);
+			exit(1);
+		}
+		while (outlen % LZIMG_ALIGN)
+			emit_byte(0);
+		seg[z.z_nseg].s_pa = ph->p_pa;
+		seg[z.z_nseg].s_memsz = ph->p_memsz;
+		seg[z.z_nseg].s_filesz = ph->p_filesz;
+		seg[z.z_nseg].s_offset = outlen;
+		compress(elf + ph->p_offset, ph->p_filesz);
+		seg[z.z_nseg].s_csize = outlen - seg[z.z_nseg].s_offset;
+		raw += ph->p_filesz;
+		z.z_nseg++;
+	}
+	memcpy(out, &z, sizeof(z));
+	memcpy(out + sizeof(z), seg, z.z_nseg * sizeof(seg[0]));
+
+	if ((f = fopen(argv[2], "wb")) == NULL
+	    || fwrite(out, 1, outlen, f) != outlen || fclose(f) != 0) {
+		perror(argv[2]);
+		exit(1);
+	}
+	fprintf(stderr, "kernel image is %zu bytes (%zu bytes uncompressed)\n",
+		outlen, raw);
+	return 0;
+}
@@ -0,0 +1,62 @@
+#ifndef JOS_INC_ALTERNATIVE_H
+#define JOS_INC_ALTERNATIVE_H
+
+#include <inc/types.h>
+
+// Alternative instructions, patched in at boot by alternatives_apply()
+// when the CPU has a feature.
+//
+//	asm volatile(ALTERNATIVE("old instructions", "new instructions")
+//		     : outputs : ALT_FEATURE(CPUID_FEATURE_X), inputs
+//		     : clobbers);
+//
+// The old instructions run until (and unless) they are replaced; they
+// are padded with NOPs if the new ones are longer.  The new ones are
+// copied over them, so they must not use relative jumps or calls out
+// of themselves.  Both must use the operands the same way.  Since the
+// asm has operands, registers in it are written as %%eax.
+
+struct alt_instr {
+	uintptr_t site;		// address of the old instructions
+	uintptr_t repl;		// address of the new instructions
+	uint16_t feature;	// CPUID_FEATURE_* the new ones need
+	uint8_t site_len;	// bytes of old instructions, with padding
+	uint8_t repl_len;	// bytes of new instructions
+} __attribute__((packed));
+
+#define ALT_FEATURE(feature)	[alt_feature] "i" (feature)
+
+#define ALTERNATIVE(oldinstr, newinstr)					\
+	"661:\n\t" oldinstr "\n"					\
+	"662:\n"							\
+	"\t.skip -(((665f-664f)-(662b-661b)) > 0)"			\
+		" * ((665f-664f)-(662b-661b)), 0x90\n"			\
+	"663:\n"							\
+	".pushsection .altinstructions, \"a\"\n"			\
+	"\t.long 661b\n"						\
+	"\t.long 664f\n"						\
+	"\t.short %c[alt_feature]\n"					\
+	"\t.byte 663b-661b\n"						\
+	"\t.byte 665f-664f\n"						\
+	".popsection\n"							\
+	".pushsection .altinstr_replacement, \"ax\"\n"			\
+	"664:\n\t" newinstr "\n"					\
+	"665:\n"							\
+	".popsection\n"
+
+// Does the CPU have feature 'bit'?  Compiles to a jump that
+// alternatives_apply() turns into NOPs if it does, so there is no
+// test at run time.  Returns false until then.
+static inline __attribute__((always_inline)) bool
+static_cpu_has(unsigned int bit)
+{
+	asm goto(ALTERNATIVE("jmp %l[t_no]", "")
+		 : : ALT_FEATURE(bit) : : t_no);
+	return true;
+t_no:
+	return false;
+}
+
+int alternatives_apply(void);
+
+#endif /* !JOS_INC_ALTERNATIVE_H */
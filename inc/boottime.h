@@ -0,0 +1,48 @@
+#ifndef JOS_INC_BOOTTIME_H
+#define JOS_INC_BOOTTIME_H
+
+// Boot-phase timestamps, taken with rdtsc by boot.S and the second-stage
+// loader and handed to the kernel through the multiboot_info extension
+// (MULTIBOOT_INFO_JOS_BOOTTIME).  The TSC starts counting at reset, so
+// each timestamp is also the time since reset.
+
+// Where the trace lives during boot, between the boot sector and the
+// e820 map at MULTIBOOT_PADDR.
+#define BOOTTIME_PADDR		0x8000
+#define BOOTTIME_NR_MAX		64
+
+// Address of the TSC of entry 'i', for boot.S, which stamps entries 0
+// (BOOTTIME_E820_BEGIN) and 1 (BOOTTIME_E820_END).  There is only room
+// in the boot sector to store the low 32 bits; the loader fills in the
+// rest of those two entries and starts its own at entry 2.
+#define BOOTTIME_TSC(i)		(BOOTTIME_PADDR + 8 + 16 * (i))
+
+#ifndef __ASSEMBLER__
+#include <inc/types.h>
+
+// Events
+enum {
+	BOOTTIME_E820_BEGIN = 0,	// boot.S, before the e820 loop
+	BOOTTIME_E820_END,		// boot.S, after the e820 loop
+	BOOTTIME_LOADER,		// loader entered
+	BOOTTIME_SEG_BEGIN,		// loader, before loading segment 'arg'
+	BOOTTIME_SEG_END,		// loader, after loading segment 'arg'
+	BOOTTIME_KERNEL,		// loader, jumping to the kernel
+	BOOTTIME_NR_EVENTS,
+};
+
+struct boottime_entry {
+	uint64_t tsc;
+	uint32_t event;
+	uint32_t arg;
+} __attribute__((packed));
+
+struct boottime {
+	uint32_t nr;
+	uint32_t reserved;
+	struct boottime_entry entries[BOOTTIME_NR_MAX];
+} __attribute__((packed));
+
+#endif /* !__ASSEMBLER__ */
+
+#endif /* !JOS_INC_BOOTTIME_H */
@@ -1,6 +1,8 @@
 #ifndef JOS_INC_CPUID_H
 #define JOS_INC_CPUID_H
 
+#include <inc/types.h>
+
 #define CPUID_BIT(base, off)	((base) * 32 + (off))
 
 enum {
@@ -84,6 +86,26 @@ enum {
 	CPUID_FEATURE_HYPERVISOR	= CPUID_BIT(CPUID_1_ECX, 31),
 };
 
+// CPUID(7, 0): EBX
+enum {
+	CPUID_FEATURE_FSGSBASE		= CPUID_BIT(CPUID_7_EBX, 0),
+	CPUID_FEATURE_TSC_ADJUST	= CPUID_BIT(CPUID_7_EBX, 1),
+	CPUID_FEATURE_BMI1		= CPUID_BIT(CPUID_7_EBX, 3),
+	CPUID_FEATURE_HLE		= CPUID_BIT(CPUID_7_EBX, 4),
+	CPUID_FEATURE_AVX2		= CPUID_BIT(CPUID_7_EBX, 5),
+	CPUID_FEATURE_SMEP		= CPUID_BIT(CPUID_7_EBX, 7),
+	CPUID_FEATURE_BMI2		= CPUID_BIT(CPUID_7_EBX, 8),
+	CPUID_FEATURE_ERMS		= CPUID_BIT(CPUID_7_EBX, 9),
+	CPUID_FEATURE_INVPCID		= CPUID_BIT(CPUID_7_EBX, 10),
+	CPUID_FEATURE_RTM		= CPUID_BIT(CPUID_7_EBX, 11),
+	CPUID_FEATURE_RDSEED		= CPUID_BIT(CPUID_7_EBX, 18),
+	CPUID_FEATURE_ADX		= CPUID_BIT(CPUID_7_EBX, 19),
+	CPUID_FEATURE_SMAP		= CPUID_BIT(CPUID_7_EBX, 20),
+	CPUID_FEATURE_CLFLUSHOPT	= CPUID_BIT(CPUID_7_EBX, 23),
+	CPUID_FEATURE_CLWB		= CPUID_BIT(CPUID_7_EBX, 24),
+	CPUID_FEATURE_SHA		= CPUID_BIT(CPUID_7_EBX, 29),
+};
+
 // CPUID(0x80000001): EDX
 enum {
 	// duplicated (fpu)		= CPUID_BIT(CPUID_80000001_EDX, 0),
@@ -149,6 +171,54 @@ enum {
 	CPUID_FEATURE_PERFCTR_NB	= CPUID_BIT(CPUID_80000001_ECX, 24),
 };
 
+extern uint32_t cpu_features[CPUID_NR_FLAGS];
+
+// Caches, from CPUID leaf 4 (Intel) or 0x8000001D (AMD).
+#define CPU_CACHE_MAX	8
+
+enum {
+	CPU_CACHE_DATA = 1,
+	CPU_CACHE_INST = 2,
+	CPU_CACHE_UNIFIED = 3,
+};
+
+struct cpu_cache {
+	uint8_t level;		// 1, 2, 3, ...
+	uint8_t type;		// CPU_CACHE_*
+	uint16_t line_size;	// bytes
+	uint16_t ways;
+	uint16_t sharing;	// logical processors sharing it, at most
+	uint32_t sets;
+	uint32_t size;		// bytes
+};
+
+// Caches and the processor topology, from CPUID leaf 0x1F or 0xB
+// (falling back to leaf 1 and 4 counts on older CPUs).  An x2APIC ID
+// splits into SMT bits [0, smt_shift), core bits [smt_shift,
+// pkg_shift) and the package number above.
+struct cpu_topology {
+	uint32_t line_size;	// L1 data cache line size: the unit
+				// for avoiding false sharing
+	uint32_t clflush_size;	// CLFLUSH line size
+	int ncache;
+	struct cpu_cache cache[CPU_CACHE_MAX];
+
+	uint32_t apic_id;	// of the boot CPU
+	uint32_t threads_per_core;
+	uint32_t cores_per_pkg;
+	uint32_t threads_per_pkg;
+	uint8_t smt_shift;
+	uint8_t pkg_shift;
+	uint32_t leaf;		// 0x1F or 0xB if used, else the leaf of
+				// the core count (4, 0x80000008), or 0
+};
+
+extern struct cpu_topology cpu_topology;
+
+void cpuid_init(void);
 void cpuid_print(void);
+void cpu_topology_init(void);
+void cpu_topology_print(void);
+bool cpuid_has_feature(unsigned int bit);
 
 #endif // !JOS_INC_CPUID_H
@@ -0,0 +1,28 @@
+#ifndef JOS_INC_LZIMG_H
+#define JOS_INC_LZIMG_H
+
+// Compressed kernel image, made from the kernel ELF by boot/mklzimg and
+// unpacked by the second-stage loader.  The image starts with a struct
+// Lzimg, followed by one struct Lzseg per loadable ELF segment.  Each
+// segment's file contents are stored as one LZ4 block (see
+// https://github.com/lz4/lz4/blob/dev/doc/lz4_Block_format.md),
+// starting on a sector boundary.
+
+#define LZIMG_MAGIC	0x474D495AU	/* "ZIMG" in little endian */
+#define LZIMG_ALIGN	512		// alignment of compressed data
+
+struct Lzimg {
+	uint32_t z_magic;	// must equal LZIMG_MAGIC
+	uint32_t z_entry;	// e_entry of the kernel
+	uint32_t z_nseg;	// number of struct Lzseg following
+};
+
+struct Lzseg {
+	uint32_t s_pa;		// load address
+	uint32_t s_memsz;	// bytes in memory
+	uint32_t s_filesz;	// bytes from the file, before compression
+	uint32_t s_offset;	// offset of the compressed data in the image
+	uint32_t s_csize;	// bytes of compressed data
+};
+
+#endif /* !JOS_INC_LZIMG_H */
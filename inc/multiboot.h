@@ -11,6 +11,10 @@
 // flags for struct multiboot_info
 #define MULTIBOOT_INFO_MEM_MAP		0x00000040
 
+// JOS extensions to the flags, set only by the JOS boot loader
+#define MULTIBOOT_INFO_JOS_BSS		0x80000000	// bss already zeroed
+#define MULTIBOOT_INFO_JOS_BOOTTIME	0x40000000	// jos_boottime valid
+
 #ifndef __ASSEMBLER__
 #include <inc/e820.h>
 
@@ -20,6 +24,8 @@ struct multiboot_info {
 	uint32_t mmap_length;
 	uint32_t mmap_addr;
 	uint32_t ignore_1[9];
+	// JOS extensions
+	uint32_t jos_boottime;	// physical address of a struct boottime
 } __attribute__((packed));
 
 struct multiboot_mmap_entry {
@@ -1,6 +1,7 @@
 #ifndef JOS_INC_STDIO_H
 #define JOS_INC_STDIO_H
 
+#include <inc/types.h>
 #include <inc/stdarg.h>
 
 #ifndef NULL
@@ -12,15 +13,55 @@ void	cputchar(int c);
 int	getchar(void);
 int	iscons(int fd);
 
+// A format string compiled by fmt_compile(), for vprintfmt_desc().
+#define FMTDESC_NSPEC	8	// conversions per format
+
+enum {
+	FMT_STAR_NONE = 0,
+	FMT_STAR_WIDTH,		// width comes from an int argument
+	FMT_STAR_PRECISION,	// precision comes from an int argument
+};
+
+struct fmtspec {
+	const char *lit;	// literal text before the conversion
+	uint16_t litlen;
+	char conv;		// conversion character; 0 ends the format
+	char padc;
+	uint8_t lflag;
+	uint8_t altflag;
+	uint8_t star;
+	int width;
+	int precision;
+};
+
+struct fmtdesc {
+	const char *fmt;	// the format compiled, or NULL
+	int nspec;		// -1 if it can't be compiled
+	struct fmtspec spec[FMTDESC_NSPEC + 1];	// plus one for the end
+};
+
 // lib/printfmt.c
 void	printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...);
 void	vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list);
+void	vprintfmt_buf(void (*putbuf)(const char*, size_t, void*), void *putdat, const char *fmt, va_list);
+int	fmt_compile(struct fmtdesc *d, const char *fmt);
+void	vprintfmt_desc(void (*putbuf)(const char*, size_t, void*), void *putdat, const struct fmtdesc *d, va_list);
 int	snprintf(char *str, int size, const char *fmt, ...);
 int	vsnprintf(char *str, int size, const char *fmt, va_list);
 
 // lib/printf.c
 int	cprintf(const char *fmt, ...);
 int	vcprintf(const char *fmt, va_list);
+int	cprintf_desc(struct fmtdesc *d, const char *fmt, ...);
+int	vcprintf_desc(struct fmtdesc *d, const char *fmt, va_list);
+
+// cprintf() for hot call sites: the format, which must be a string
+// literal, is parsed on the first call only.
+#define CPRINTF(fmt, ...)						\
+({									\
+	static struct fmtdesc __fd;					\
+	cprintf_desc(&__fd, "" fmt, ##__VA_ARGS__);			\
+})
 
 // lib/fprintf.c
 int	printf(const char *fmt, ...);
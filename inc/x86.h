@@ -223,13 +223,15 @@ read_esp(void)
 	return esp;
 }
 
+// CPUID leaf 'info', subleaf 'index'.
 static inline void
-cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp)
+cpuid_count(uint32_t info, uint32_t index,
+	    uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp)
 {
 	uint32_t eax, ebx, ecx, edx;
 	asm volatile("cpuid"
 		     : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
-		     : "a" (info));
+		     : "a" (info), "c" (index));
 	if (eaxp)
 		*eaxp = eax;
 	if (ebxp)
@@ -240,6 +242,12 @@ cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *e
 		*edxp = edx;
 }
 
+static inline void
+cpuid(uint32_t info, uint32_t *eaxp, uint32_t *ebxp, uint32_t *ecxp, uint32_t *edxp)
+{
+	cpuid_count(info, 0, eaxp, ebxp, ecxp, edxp);
+}
+
 static inline uint64_t
 read_tsc(void)
 {
@@ -0,0 +1,34 @@
+/* See COPYRIGHT for copyright information. */
+
+// Boot-time patching of alternative instructions; see inc/alternative.h.
+
+#include <inc/alternative.h>
+#include <inc/cpuid.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+extern const struct alt_instr __alt_begin[], __alt_end[];
+
+// Patch every site whose feature the CPU has.  Must run before
+// anything uses the sites concurrently -- at boot, with interrupts
+// off.  Kernel text is writable until a real page table exists.
+// Returns the number of sites patched.
+int
+alternatives_apply(void)
+{
+	const struct alt_instr *a;
+	uint8_t *site;
+	int n = 0;
+
+	for (a = __alt_begin; a < __alt_end; a++) {
+		if (!cpuid_has_feature(a->feature))
+			continue;
+		site = (uint8_t *) a->site;
+		memcpy(site, (const void *) a->repl, a->repl_len);
+		memset(site + a->repl_len, 0x90, a->site_len - a->repl_len);
+		n++;
+	}
+	// Don't run stale prefetched instructions.
+	cpuid(0, NULL, NULL, NULL, NULL);
+	return n;
+}
@@ -0,0 +1,199 @@
+/* See COPYRIGHT for copyright information. */
+
+// Microbenchmarks, run from the kernel monitor with 'bench'.
+//
+// Each benchmark (see BENCH() in kern/bench.h) is timed 'iters' times,
+// each time over BENCH_BATCH operations, between serializing TSC
+// reads.  The cost of the TSC reads themselves is measured first and
+// subtracted.  The result is one line per benchmark:
+//
+//	bench NAME: iters N min A med B p99 C cycles/op D
+//
+// where A, B and C are cycles per operation over the timed batches,
+// and D is the mean.  The format is meant to stay stable, so scripts
+// (gradelib's Runner.match, for one) can pick numbers out of it.
+
+#include <inc/alternative.h>
+#include <inc/stdio.h>
+#include <inc/string.h>
+#include <inc/cpuid.h>
+#include <inc/x86.h>
+
+#include <kern/bench.h>
+
+#define BENCH_BATCH	16	// operations per timed sample
+#define BENCH_MAX_ITERS	1024	// samples kept per benchmark
+
+extern const struct bench __bench_begin[], __bench_end[];
+
+static uint32_t samples[BENCH_MAX_ITERS];
+
+// Read the TSC once everything before has finished.
+static inline uint64_t
+tsc_begin(void)
+{
+	cpuid(0, NULL, NULL, NULL, NULL);
+	return read_tsc();
+}
+
+// Read the TSC once everything before has finished, and keep what
+// follows from starting early.
+static inline uint64_t
+tsc_end(void)
+{
+	uint64_t tsc;
+
+	asm volatile(ALTERNATIVE("xorl %%eax, %%eax; cpuid; rdtsc", "rdtscp")
+		     : "=A" (tsc) : ALT_FEATURE(CPUID_FEATURE_RDTSCP)
+		     : "ebx", "ecx");
+	cpuid(0, NULL, NULL, NULL, NULL);
+	return tsc;
+}
+
+static void
+sort(uint32_t *a, int n)
+{
+	int i, j;
+	uint32_t v;
+
+	for (i = 1; i < n; i++) {
+		v = a[i];
+		for (j = i; j > 0 && a[j - 1] > v; j--)
+			a[j] = a[j - 1];
+		a[j] = v;
+	}
+}
+
+// Cycles for an empty timed region.
+static uint32_t
+tsc_overhead(void)
+{
+	uint64_t t0;
+	uint32_t t, min = ~0U;
+	int i;
+
+	for (i = 0; i < 64; i++) {
+		t0 = tsc_begin();
+		t = tsc_end() - t0;
+		if (t < min)
+			min = t;
+	}
+	return min;
+}
+
+static void
+bench_one(const struct bench *b, int iters, uint32_t overhead)
+{
+	uint64_t t0, total;
+	uint32_t t;
+	int i;
+
+	// Warm up the caches.
+	b->run(BENCH_BATCH);
+
+	total = 0;
+	for (i = 0; i < iters; i++) {
+		t0 = tsc_begin();
+		b->run(BENCH_BATCH);
+		t = tsc_end() - t0;
+		t = (t > overhead ? t - overhead : 0);
+		samples[i] = t;
+		total += t;
+	}
+	sort(samples, iters);
+	cprintf("bench %s: iters %d min %u med %u p99 %u cycles/op %u\n",
+		b->name, iters,
+		samples[0] / BENCH_BATCH,
+		samples[iters / 2] / BENCH_BATCH,
+		samples[iters * 99 / 100] / BENCH_BATCH,
+		(uint32_t) (total / ((uint64_t) iters * BENCH_BATCH)));
+}
+
+// Run the benchmark 'name', or all of them if 'name' is NULL, 'iters'
+// times each.  Returns the number of benchmarks run.
+int
+bench_run(const char *name, int iters)
+{
+	const struct bench *b;
+	uint32_t overhead;
+	int n = 0;
+
+	if (iters > BENCH_MAX_ITERS)
+		iters = BENCH_MAX_ITERS;
+	overhead = tsc_overhead();
+	for (b = __bench_begin; b < __bench_end; b++)
+		if (!name || strcmp(b->name, name) == 0) {
+			bench_one(b, iters, overhead);
+			n++;
+		}
+	return n;
+}
+
+// Number of registered benchmarks.
+int
+bench_count(void)
+{
+	return __bench_end - __bench_begin;
+}
+
+void
+bench_list(void)
+{
+	const struct bench *b;
+
+	for (b = __bench_begin; b < __bench_end; b++)
+		cprintf("  %-16s %s\n", b->name, b->desc);
+}
+
+// Benchmarks of lib/
+
+static char bench_src[4096 + 64], bench_dst[4096 + 64];
+
+BENCH(memcpy_64, "memcpy of 64 bytes")
+{
+	while (n-- > 0)
+		memcpy(bench_dst, bench_src, 64);
+}
+
+BENCH(memcpy_4k, "memcpy of 4KB")
+{
+	while (n-- > 0)
+		memcpy(bench_dst, bench_src, 4096);
+}
+
+BENCH(memcpy_4k_unaligned, "memcpy of 4KB, misaligned by 1 and 3")
+{
+	while (n-- > 0)
+		memcpy(bench_dst + 1, bench_src + 3, 4096);
+}
+
+BENCH(memset_4k, "memset of 4KB")
+{
+	while (n-- > 0)
+		memset(bench_dst, 0, 4096);
+}
+
+BENCH(strlen_64, "strlen of 64 bytes")
+{
+	static const char str[] =
+		"0123456789abcdef0123456789abcdef0123456789abcdef0123456789abcdef";
+
+	while (n-- > 0)
+		strlen(str);
+}
+
+// snprintf of one conversion.  The empty format shows the fixed cost
+// of the call itself.
+#define BENCH_SNPRINTF(name, fmt, arg)					\
+BENCH(snprintf_##name, "snprintf(\"" fmt "\")")			\
+{									\
+	char buf[32];							\
+									\
+	while (n-- > 0)							\
+		snprintf(buf, sizeof(buf), fmt, arg);			\
+}
+
+BENCH_SNPRINTF(empty, "", 0)
+BENCH_SNPRINTF(d, "%d", -123456789)
+BENCH_SNPRINTF(x, "%x", 0xdeadbeef)
+BENCH_SNPRINTF(llu, "%llu", 18446744073709551615ULL)
@@ -0,0 +1,35 @@
+#ifndef JOS_KERN_BENCH_H
+#define JOS_KERN_BENCH_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// A microbenchmark for the 'bench' monitor command.  'run' performs
+// the operation being measured 'n' times.
+struct bench {
+	const char *name;
+	const char *desc;
+	void (*run)(uint32_t n);
+};
+
+// Define and register a benchmark, in the .bench section:
+//
+//	BENCH(memcpy_4k, "memcpy of 4KB")
+//	{
+//		while (n-- > 0)
+//			memcpy(dst, src, 4096);
+//	}
+#define BENCH(name, desc)						\
+	static void bench_run_##name(uint32_t n);			\
+	static const struct bench bench_##name				\
+		__attribute__((section(".bench"), used, aligned(4))) =	\
+		{ #name, desc, bench_run_##name };			\
+	static void bench_run_##name(uint32_t n)
+
+int bench_count(void);
+int bench_run(const char *name, int iters);
+void bench_list(void);
+
+#endif	// !JOS_KERN_BENCH_H
@@ -0,0 +1,98 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/boottime.h>
+#include <inc/multiboot.h>
+#include <inc/stdio.h>
+#include <inc/x86.h>
+
+#include <kern/boottime.h>
+#include <kern/klog.h>
+#include <kern/tsc.h>
+
+// The boot timeline, from reset to the monitor prompt: the loader's
+// timestamps (if it passed any), then the kernel's.  Each kernel
+// timestamp marks the end of the step it names.
+
+#define NSTAMPS		(BOOTTIME_NR_MAX + 16)
+
+static struct {
+	uint64_t tsc;
+	const char *what;
+	int arg;		// segment number, or -1
+} stamps[NSTAMPS];
+static int nstamps;
+
+static const char *events[] = {
+	[BOOTTIME_E820_BEGIN]	= "boot: e820 begin",
+	[BOOTTIME_E820_END]	= "boot: e820 end",
+	[BOOTTIME_LOADER]	= "loader: start",
+	[BOOTTIME_SEG_BEGIN]	= "loader: load segment",
+	[BOOTTIME_SEG_END]	= "loader: loaded segment",
+	[BOOTTIME_KERNEL]	= "loader: jump to kernel",
+};
+
+static void
+record(uint64_t tsc, const char *what, int arg)
+{
+	if (nstamps == NSTAMPS)
+		return;
+	stamps[nstamps].tsc = tsc;
+	stamps[nstamps].what = what;
+	stamps[nstamps].arg = arg;
+	nstamps++;
+}
+
+// Start the timeline with the loader's timestamps, if any, and the
+// kernel entry time 'entry_tsc'.  Must run after the bss is cleared.
+void
+boottime_init(uint64_t entry_tsc, uint32_t magic, struct multiboot_info *mbi)
+{
+	struct boottime *bt;
+	struct boottime_entry *e;
+	uint32_t i;
+
+	if (magic == MULTIBOOT_BOOTLOADER_MAGIC
+	    && (mbi->flags & MULTIBOOT_INFO_JOS_BOOTTIME)) {
+		bt = (struct boottime *) mbi->jos_boottime;
+		for (i = 0; i < bt->nr && i < BOOTTIME_NR_MAX; i++) {
+			e = &bt->entries[i];
+			if (e->event >= BOOTTIME_NR_EVENTS)
+				continue;
+			record(e->tsc, events[e->event],
+			       (e->event == BOOTTIME_SEG_BEGIN
+				|| e->event == BOOTTIME_SEG_END) ? e->arg : -1);
+		}
+	}
+	record(entry_tsc, "kernel: entry", -1);
+}
+
+void
+boottime_stamp(const char *what)
+{
+	record(read_tsc(), what, -1);
+	klog("boot: %s\n", what);
+}
+
+void
+boottime_print(void)
+{
+	uint32_t khz = tsc_khz();
+	uint64_t prev = 0;
+	int i;
+
+	if (!khz) {
+		cprintf("TSC frequency unknown\n");
+		return;
+	}
+	cprintf("TSC %u.%03u MHz (from %s)\n", khz / 1000, khz % 1000,
+		tsc_source());
+	cprintf("%12s %10s  event\n", "usec", "+usec");
+	for (i = 0; i < nstamps; i++) {
+		cprintf("%12llu %10llu  %s", stamps[i].tsc * 1000 / khz,
+			(stamps[i].tsc - prev) * 1000 / khz, stamps[i].what);
+		if (stamps[i].arg >= 0)
+			cprintf(" %d", stamps[i].arg);
+		cprintf("\n");
+		prev = stamps[i].tsc;
+	}
+}
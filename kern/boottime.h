@@ -0,0 +1,15 @@
+#ifndef JOS_KERN_BOOTTIME_H
+#define JOS_KERN_BOOTTIME_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+struct multiboot_info;
+
+void boottime_init(uint64_t entry_tsc, uint32_t magic, struct multiboot_info *mbi);
+void boottime_stamp(const char *what);
+void boottime_print(void);
+
+#endif	// !JOS_KERN_BOOTTIME_H
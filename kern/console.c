@@ -5,11 +5,22 @@
 #include <inc/kbdreg.h>
 #include <inc/string.h>
 #include <inc/assert.h>
+#include <inc/error.h>
+#include <inc/trap.h>
+#include <inc/alternative.h>
+#include <inc/cpuid.h>
 
 #include <kern/console.h>
+#include <kern/trap.h>
+#include <kern/picirq.h>
 
 static void cons_intr(int (*proc)(void));
 static void cons_putc(int c);
+static void cga_set_origin(void);
+static void cga_flush(void);
+static void serial_write(const char *buf, size_t n);
+
+extern const char *panicstr;
 
 // Stupid I/O delay routine necessitated by historical PC design flaws
 static void
@@ -31,8 +42,13 @@ delay(void)
 #define COM_DLM		1	// Out: Divisor Latch High (DLAB=1)
 #define COM_IER		1	// Out: Interrupt Enable Register
 #define   COM_IER_RDI	0x01	//   Enable receiver data interrupt
+#define   COM_IER_TXI	0x02	//   Enable transmitter empty interrupt
 #define COM_IIR		2	// In:	Interrupt ID Register
+#define   COM_IIR_FIFO	0xC0	//   FIFOs enabled (16550A and later)
 #define COM_FCR		2	// Out: FIFO Control Register
+#define   COM_FCR_ENABLE 0x01	//   Enable FIFOs
+#define   COM_FCR_RCLR	0x02	//   Clear receive FIFO
+#define   COM_FCR_TCLR	0x04	//   Clear transmit FIFO
 #define COM_LCR		3	// Out: Line Control Register
 #define	  COM_LCR_DLAB	0x80	//   Divisor latch access bit
 #define	  COM_LCR_WLEN8	0x03	//   Wordlength: 8 bits
@@ -45,7 +61,29 @@ delay(void)
 #define   COM_LSR_TXRDY	0x20	//   Transmit buffer avail
 #define   COM_LSR_TSRE	0x40	//   Transmitter off
 
+#define COM_FIFO_SIZE	16	// 16550A transmit FIFO depth
+
+// Line speed; build with -DCOM_BAUD=... to change it.
+#ifndef COM_BAUD
+#define COM_BAUD	115200
+#endif
+
 static bool serial_exists;
+static int serial_fifo = 1;	// bytes the UART takes per TXRDY
+static uint8_t serial_ier;	// current COM_IER
+
+// Output is queued here and moved to the UART a FIFO's worth at a
+// time.  With interrupts off, which is everywhere but cons_idle(),
+// each line is sent before serial_write() returns, so nothing is lost
+// if the kernel hangs.  Anything left over, such as a prompt, goes
+// out from the TXI interrupt while cons_idle() waits.
+#define SERIAL_TXBUFSIZE 1024
+
+static struct {
+	uint8_t buf[SERIAL_TXBUFSIZE];
+	uint32_t rpos;
+	uint32_t wpos;
+} serial_tx;
 
 static int
 serial_proc_data(void)
@@ -55,15 +93,45 @@ serial_proc_data(void)
 	return inb(COM1+COM_RX);
 }
 
-void
-serial_intr(void)
+static void
+serial_set_ier(uint8_t ier)
 {
-	if (serial_exists)
-		cons_intr(serial_proc_data);
+	if (ier != serial_ier) {
+		serial_ier = ier;
+		outb(COM1+COM_IER, ier);
+	}
 }
 
+// Refill the transmitter from the transmit ring for as long as it
+// takes more, and ask for an interrupt when it empties if there's
+// still more left.
 static void
-serial_putc(int c)
+serial_tx_start(void)
+{
+	uint32_t room, n;
+
+	while (serial_tx.rpos != serial_tx.wpos
+	       && (inb(COM1+COM_LSR) & COM_LSR_TXRDY)) {
+		// At most two contiguous runs of the ring fit in the FIFO.
+		for (room = serial_fifo;
+		     room > 0 && serial_tx.rpos != serial_tx.wpos; room -= n) {
+			n = (serial_tx.wpos > serial_tx.rpos ? serial_tx.wpos
+			     : SERIAL_TXBUFSIZE) - serial_tx.rpos;
+			n = MIN(n, room);
+			outsb(COM1+COM_TX, serial_tx.buf + serial_tx.rpos, n);
+			serial_tx.rpos += n;
+			if (serial_tx.rpos == SERIAL_TXBUFSIZE)
+				serial_tx.rpos = 0;
+		}
+	}
+	serial_set_ier(COM_IER_RDI
+		       | (serial_tx.rpos != serial_tx.wpos ? COM_IER_TXI : 0));
+}
+
+// Wait for the transmitter to empty, giving up after a while in case
+// there's nothing listening.  Returns false if it gave up.
+static bool
+serial_tx_wait(void)
 {
 	int i;
 
@@ -71,34 +139,112 @@ serial_putc(int c)
 	     !(inb(COM1 + COM_LSR) & COM_LSR_TXRDY) && i < 12800;
 	     i++)
 		delay();
+	return i < 12800;
+}
+
+// Send everything in the transmit ring, synchronously.  If the UART
+// stops taking bytes, drop what's left rather than spin forever.
+static void
+serial_flush(void)
+{
+	while (serial_tx.rpos != serial_tx.wpos) {
+		if (!serial_tx_wait())
+			serial_tx.rpos = serial_tx.wpos;
+		serial_tx_start();
+	}
+}
 
-	outb(COM1 + COM_TX, c);
+// Send 'n' raw bytes to COM1, whether or not the serial sink is enabled,
+// and wait until they're all out.
+void
+serial_send(const void *buf, size_t n)
+{
+	serial_write(buf, n);
+	serial_flush();
+}
+
+void
+serial_intr(void)
+{
+	if (serial_exists) {
+		cons_intr(serial_proc_data);
+		serial_tx_start();
+	}
+}
+
+static void
+serial_write(const char *buf, size_t n)
+{
+	uint32_t next, queued;
+	bool newline = 0;
+	size_t i;
+
+	// After a panic, interrupts and polling may never come, so
+	// write everything out before returning.
+	if (panicstr) {
+		serial_flush();
+		for (i = 0; i < n; i++) {
+			serial_tx_wait();
+			outb(COM1 + COM_TX, buf[i]);
+		}
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		next = (serial_tx.wpos + 1) % SERIAL_TXBUFSIZE;
+		if (next == serial_tx.rpos)
+			serial_flush();
+		serial_tx.buf[serial_tx.wpos] = buf[i];
+		serial_tx.wpos = next;
+		newline |= (buf[i] == '\n');
+	}
+
+	queued = (serial_tx.wpos - serial_tx.rpos) % SERIAL_TXBUFSIZE;
+	if (newline && !(read_eflags() & FL_IF))
+		serial_flush();
+	else if (newline || queued >= serial_fifo)
+		serial_tx_start();
+}
+
+static void
+serial_putc(int c)
+{
+	char ch = c;
+
+	serial_write(&ch, 1);
 }
 
 static void
 serial_init(void)
 {
-	// Turn off the FIFO
-	outb(COM1+COM_FCR, 0);
+	// Turn on and clear the FIFOs; interrupt on every received byte
+	outb(COM1+COM_FCR, COM_FCR_ENABLE | COM_FCR_RCLR | COM_FCR_TCLR);
 
 	// Set speed; requires DLAB latch
 	outb(COM1+COM_LCR, COM_LCR_DLAB);
-	outb(COM1+COM_DLL, (uint8_t) (115200 / 9600));
-	outb(COM1+COM_DLM, 0);
+	outb(COM1+COM_DLL, (uint8_t) (115200 / COM_BAUD));
+	outb(COM1+COM_DLM, (uint8_t) ((115200 / COM_BAUD) >> 8));
 
 	// 8 data bits, 1 stop bit, parity off; turn off DLAB latch
 	outb(COM1+COM_LCR, COM_LCR_WLEN8 & ~COM_LCR_DLAB);
 
-	// No modem controls
-	outb(COM1+COM_MCR, 0);
+	// No modem controls; OUT2 connects the interrupt line on PCs
+	outb(COM1+COM_MCR, COM_MCR_OUT2);
 	// Enable rcv interrupts
-	outb(COM1+COM_IER, COM_IER_RDI);
+	serial_ier = COM_IER_RDI;
+	outb(COM1+COM_IER, serial_ier);
 
 	// Clear any preexisting overrun indications and interrupts
 	// Serial port doesn't exist if COM_LSR returns 0xFF
 	serial_exists = (inb(COM1+COM_LSR) != 0xFF);
-	(void) inb(COM1+COM_IIR);
+	// Only a 16550A or later has working FIFOs
+	serial_fifo = ((inb(COM1+COM_IIR) & COM_IIR_FIFO) == COM_IIR_FIFO
+		       ? COM_FIFO_SIZE : 1);
 	(void) inb(COM1+COM_RX);
+
+	// Enable serial interrupts
+	if (serial_exists)
+		irq_setmask_8259A(irq_mask_8259A & ~(1<<IRQ_SERIAL));
 }
 
 
@@ -107,16 +253,62 @@ serial_init(void)
 // For information on PC parallel port programming, see the class References
 // page.
 
+#define LPT1		0x378
+
+// A standard parallel port reads back its data register.
+static bool
+lpt_probe(void)
+{
+	outb(LPT1+0, 0xAA);
+	return inb(LPT1+0) == 0xAA;
+}
+
 static void
 lpt_putc(int c)
 {
 	int i;
 
-	for (i = 0; !(inb(0x378+1) & 0x80) && i < 12800; i++)
+	for (i = 0; !(inb(LPT1+1) & 0x80) && i < 12800; i++)
 		delay();
-	outb(0x378+0, c);
-	outb(0x378+2, 0x08|0x04|0x01);
-	outb(0x378+2, 0x08);
+	outb(LPT1+0, c);
+	outb(LPT1+2, 0x08|0x04|0x01);
+	outb(LPT1+2, 0x08);
+}
+
+static void
+lpt_write(const char *buf, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		lpt_putc(buf[i]);
+}
+
+
+
+/***** QEMU/Bochs debug console output code *****/
+// Bytes written to port 0xE9 go straight to QEMU's -debugcon chardev
+// (or to the Bochs console), with no status to poll.
+
+#define DEBUGCON	0xE9
+
+// The debug console reads back as 0xE9; an absent port as 0xFF.
+static bool
+debugcon_probe(void)
+{
+	return inb(DEBUGCON) == 0xE9;
+}
+
+static void
+debugcon_putc(int c)
+{
+	outb(DEBUGCON, c);
+}
+
+static void
+debugcon_write(const char *buf, size_t n)
+{
+	outsb(DEBUGCON, buf, n);
 }
 
 
@@ -124,9 +316,35 @@ lpt_putc(int c)
 
 /***** Text-mode CGA/VGA display output *****/
 
+// Characters are drawn into crt_shadow, a copy of the screen in RAM,
+// and each changed row is marked in crt_dirty.  cga_flush() copies the
+// dirty rows to text memory and moves the cursor; it runs at the end
+// of each cons_write(), at each newline from cputchar(), and whenever
+// cons_getc() looks for input.  Text memory is slow and the CRTC's
+// ports are slower, so both are touched as little as possible.
+//
+// With hardware scrolling, the screen is a window of CRT_SIZE cells
+// that slides down the CRT_WINDOW cells of text memory: scrolling one
+// line just moves the 6845 start address (registers 12 and 13) by
+// CRT_COLS, and the screen is rewritten at the start of text memory
+// only when the window reaches the end.  Otherwise the screen stays at
+// the start of text memory and scrolling redraws all of it.  The
+// monochrome adapter only has 4KB of text memory, so it always does
+// that; build with -DCGA_SCROLL_COPY to do so on color adapters too.
+
+#define CRT_ALLDIRTY	((1U << CRT_ROWS) - 1)
+
 static unsigned addr_6845;
-static uint16_t *crt_buf;
+static uint16_t *crt_mem;	// start of text memory
+static uint16_t *crt_buf;	// start of the screen: crt_mem + crt_origin
+static uint16_t crt_origin;
 static uint16_t crt_pos;
+static bool crt_hwscroll;
+
+static uint16_t crt_shadow[CRT_SIZE];
+static uint32_t crt_dirty;	// bit i set if row i needs flushing
+static uint32_t crt_scrolls;	// lines scrolled since the last flush
+static uint16_t crt_cursor;	// cursor position in the hardware
 
 static void
 cga_init(void)
@@ -146,20 +364,89 @@ cga_init(void)
 		addr_6845 = CGA_BASE;
 	}
 
+#ifndef CGA_SCROLL_COPY
+	crt_hwscroll = (addr_6845 == CGA_BASE);
+#endif
+
 	/* Extract cursor location */
 	outb(addr_6845, 14);
 	pos = inb(addr_6845 + 1) << 8;
 	outb(addr_6845, 15);
 	pos |= inb(addr_6845 + 1);
 
-	crt_buf = (uint16_t*) cp;
-	crt_pos = pos;
+	/* Show the screen from the start of text memory */
+	crt_mem = (uint16_t*) cp;
+	crt_origin = 0;
+	crt_buf = crt_mem;
+	crt_pos = (pos < CRT_SIZE ? pos : 0);
+	crt_cursor = pos;
+	cga_set_origin();
+
+	memmove(crt_shadow, crt_buf, sizeof(crt_shadow));
+	crt_dirty = 0;
+	crt_scrolls = 0;
 }
 
+static void
+cga_set_origin(void)
+{
+	outb(addr_6845, 12);
+	outb(addr_6845 + 1, crt_origin >> 8);
+	outb(addr_6845, 13);
+	outb(addr_6845 + 1, crt_origin);
+}
 
+// Scroll the shadow screen up one line, leaving the last line stale.
+static void
+cga_scroll(void)
+{
+	memmove(crt_shadow, crt_shadow + CRT_COLS, (CRT_SIZE - CRT_COLS) * sizeof(uint16_t));
+	crt_scrolls++;
+	if (crt_hwscroll)
+		crt_dirty = (crt_dirty >> 1) | (1U << (CRT_ROWS - 1));
+	else
+		crt_dirty = CRT_ALLDIRTY;
+}
 
+// Bring text memory and the cursor up to date with the shadow screen.
 static void
-cga_putc(int c)
+cga_flush(void)
+{
+	uint32_t r;
+	uint16_t cursor;
+
+	if (crt_scrolls && crt_hwscroll) {
+		// Rows that scrolled into view are already dirty.
+		if (crt_scrolls >= CRT_ROWS
+		    || crt_origin + CRT_SIZE + crt_scrolls * CRT_COLS > CRT_WINDOW) {
+			crt_origin = 0;
+			crt_dirty = CRT_ALLDIRTY;
+		} else
+			crt_origin += crt_scrolls * CRT_COLS;
+		crt_buf = crt_mem + crt_origin;
+		cga_set_origin();
+	}
+	crt_scrolls = 0;
+
+	for (r = 0; crt_dirty; r++, crt_dirty >>= 1)
+		if (crt_dirty & 1)
+			memmove(crt_buf + r * CRT_COLS, crt_shadow + r * CRT_COLS,
+				CRT_COLS * sizeof(uint16_t));
+
+	/* move that little blinky thing */
+	cursor = crt_origin + crt_pos;
+	if (cursor != crt_cursor) {
+		crt_cursor = cursor;
+		outb(addr_6845, 14);
+		outb(addr_6845 + 1, cursor >> 8);
+		outb(addr_6845, 15);
+		outb(addr_6845 + 1, cursor);
+	}
+}
+
+// Put 'c' on the shadow screen.
+static void
+cga_putch(int c)
 {
 	// if no attribute given, then use black on white
 	if (!(c & ~0xFF))
@@ -169,7 +456,8 @@ cga_putc(int c)
 	case '\b':
 		if (crt_pos > 0) {
 			crt_pos--;
-			crt_buf[crt_pos] = (c & ~0xff) | ' ';
+			crt_shadow[crt_pos] = (c & ~0xff) | ' ';
+			crt_dirty |= 1U << (crt_pos / CRT_COLS);
 		}
 		break;
 	case '\n':
@@ -179,14 +467,16 @@ cga_putc(int c)
 		crt_pos -= (crt_pos % CRT_COLS);
 		break;
 	case '\t':
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
-		cons_putc(' ');
+		// Only on the screen: the other sinks already have the tab.
+		cga_putch((c & ~0xff) | ' ');
+		cga_putch((c & ~0xff) | ' ');
+		cga_putch((c & ~0xff) | ' ');
+		cga_putch((c & ~0xff) | ' ');
+		cga_putch((c & ~0xff) | ' ');
 		break;
 	default:
-		crt_buf[crt_pos++] = c;		/* write the character */
+		crt_dirty |= 1U << (crt_pos / CRT_COLS);
+		crt_shadow[crt_pos++] = c;	/* write the character */
 		break;
 	}
 
@@ -194,17 +484,30 @@ cga_putc(int c)
 	if (crt_pos >= CRT_SIZE) {
 		int i;
 
-		memmove(crt_buf, crt_buf + CRT_COLS, (CRT_SIZE - CRT_COLS) * sizeof(uint16_t));
+		cga_scroll();
 		for (i = CRT_SIZE - CRT_COLS; i < CRT_SIZE; i++)
-			crt_buf[i] = 0x0700 | ' ';
+			crt_shadow[i] = 0x0700 | ' ';
 		crt_pos -= CRT_COLS;
 	}
+}
 
-	/* move that little blinky thing */
-	outb(addr_6845, 14);
-	outb(addr_6845 + 1, crt_pos >> 8);
-	outb(addr_6845, 15);
-	outb(addr_6845 + 1, crt_pos);
+static void
+cga_putc(int c)
+{
+	cga_putch(c);
+	if ((c & 0xff) == '\n')
+		cga_flush();
+}
+
+// Put 'n' characters on the screen, then flush once.
+static void
+cga_write(const char *buf, size_t n)
+{
+	size_t i;
+
+	for (i = 0; i < n; i++)
+		cga_putch((uint8_t) buf[i]);
+	cga_flush();
 }
 
 
@@ -372,6 +675,9 @@ kbd_intr(void)
 static void
 kbd_init(void)
 {
+	// Drain the kbd buffer so that QEMU generates interrupts.
+	kbd_intr();
+	irq_setmask_8259A(irq_mask_8259A & ~(1<<IRQ_KBD));
 }
 
 
@@ -411,6 +717,9 @@ cons_getc(void)
 {
 	int c;
 
+	// show what has been echoed so far
+	cga_flush();
+
 	// poll for any pending input characters,
 	// so that this function works even when interrupts are disabled
 	// (e.g., when called from the kernel monitor).
@@ -427,23 +736,123 @@ cons_getc(void)
 	return 0;
 }
 
+// Console output goes to every output sink that is both present and
+// enabled.  cons_init() probes for each sink and enables those named in
+// CONS_SINKS; the monitor's 'console' command can change that later.
+#ifndef CONS_SINKS
+#define CONS_SINKS	"serial lpt cga debugcon"
+#endif
+
+static bool
+serial_probe(void)
+{
+	return serial_exists;
+}
+
+static bool
+cga_probe(void)
+{
+	// cga_init() falls back to the monochrome adapter
+	return 1;
+}
+
+static struct {
+	const char *name;
+	bool (*probe)(void);
+	void (*putc)(int c);
+	void (*write)(const char *buf, size_t n);
+	bool present;
+	bool enabled;
+} sinks[] = {
+	{ "serial", serial_probe, serial_putc, serial_write },
+	{ "lpt", lpt_probe, lpt_putc, lpt_write },
+	{ "cga", cga_probe, cga_putc, cga_write },
+	{ "debugcon", debugcon_probe, debugcon_putc, debugcon_write },
+};
+
 // output a character to the console
 static void
 cons_putc(int c)
 {
-	serial_putc(c);
-	lpt_putc(c);
-	cga_putc(c);
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sinks); i++)
+		if (sinks[i].enabled)
+			sinks[i].putc(c);
+}
+
+// output 'n' characters to the console
+void
+cons_write(const char *buf, size_t n)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sinks); i++)
+		if (sinks[i].enabled)
+			sinks[i].write(buf, n);
+}
+
+// Is 'name' one of the space-separated words in 'list'?
+static bool
+in_list(const char *name, const char *list)
+{
+	size_t n = strlen(name);
+
+	while (*list) {
+		if (strncmp(list, name, n) == 0 && (list[n] == ' ' || list[n] == 0))
+			return 1;
+		while (*list && *list != ' ')
+			list++;
+		while (*list == ' ')
+			list++;
+	}
+	return 0;
+}
+
+// Enable or disable the output sink called 'name'.
+// Returns 0 on success, < 0 if there is no such sink present.
+int
+cons_sink_enable(const char *name, bool enable)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sinks); i++)
+		if (strcmp(sinks[i].name, name) == 0) {
+			if (!sinks[i].present)
+				return -E_INVAL;
+			sinks[i].enabled = enable;
+			return 0;
+		}
+	return -E_INVAL;
+}
+
+void
+cons_sink_print(void)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(sinks); i++)
+		cprintf("  %-10s %s\n", sinks[i].name,
+			!sinks[i].present ? "absent"
+			: sinks[i].enabled ? "on" : "off");
 }
 
 // initialize the console devices
 void
 cons_init(void)
 {
+	int i;
+
 	cga_init();
 	kbd_init();
 	serial_init();
 
+	for (i = 0; i < ARRAY_SIZE(sinks); i++) {
+		sinks[i].present = sinks[i].probe();
+		sinks[i].enabled = sinks[i].present
+			&& in_list(sinks[i].name, CONS_SINKS);
+	}
+
 	if (!serial_exists)
 		cprintf("Serial port does not exist!\n");
 }
@@ -457,13 +866,32 @@ cputchar(int c)
 	cons_putc(c);
 }
 
+// Sleep until an interrupt, which may bring input.  Use MONITOR/MWAIT
+// on the input ring where the CPU has them, else HLT.  Interrupts are
+// only on while we sleep; sti delays them by one instruction, so one
+// that arrives after the caller checked for input still wakes us.
+static void
+cons_idle(void)
+{
+	if (!trap_ready)
+		return;
+
+	if (static_cpu_has(CPUID_FEATURE_MONITOR)) {
+		asm volatile("monitor" : : "a" (&cons.wpos), "c" (0), "d" (0));
+		if (cons.rpos != cons.wpos)
+			return;
+		asm volatile("sti; mwait; cli" : : "a" (0), "c" (0) : "memory");
+	} else
+		asm volatile("sti; hlt; cli" : : : "memory");
+}
+
 int
 getchar(void)
 {
 	int c;
 
 	while ((c = cons_getc()) == 0)
-		/* do nothing */;
+		cons_idle();
 	return c;
 }
 
@@ -16,9 +16,15 @@
 #define CRT_ROWS	25
 #define CRT_COLS	80
 #define CRT_SIZE	(CRT_ROWS * CRT_COLS)
+#define CRT_WINDOW	(0x8000 / 2)	// cells of color text memory (32KB)
 
 void cons_init(void);
 int cons_getc(void);
+void cons_write(const char *buf, size_t n);
+int cons_sink_enable(const char *name, bool enable);
+void cons_sink_print(void);
+
+void serial_send(const void *buf, size_t n);
 
 void kbd_intr(void); // irq 1
 void serial_intr(void); // irq 4
@@ -1,5 +1,10 @@
 #include <inc/mmu.h>
 #include <inc/memlayout.h>
+#include <inc/e820.h>
+#include <inc/cpuid.h>
+#include <inc/x86.h>
+
+#include <kern/entrypgdir.h>
 
 pte_t entry_pgtable[NPTENTRIES];
 
@@ -9,8 +14,17 @@ pte_t entry_pgtable[NPTENTRIES];
 // We choose 4MB because that's how much we can map with one page
 // table and it's enough to get us through early boot.  We also map
 // virtual addresses [0, 4MB) to physical addresses [0, 4MB); this
-// region is critical for a few instructions in entry.S and then we
-// never use it again.
+// region is critical for a few instructions in entry.S, and i386_init
+// reads the boot loader's multiboot information and e820 map through
+// it, by physical address, up to e820_init().  Until trap_init()
+// installs the kernel's own GDT, the segment descriptors come from the
+// boot sector's GDT, also reached through this map.
+//
+// Once e820_init() has read the memory map, entry_pgdir_map() extends
+// the KERNBASE mapping to all available RAM that fits below 4GB, with
+// more 4MB pages, so early code can reach any page of RAM at KERNBASE
+// plus its physical address.  The kernel mappings are global, so they
+// survive TLB flushes on cr3 reloads.
 //
 // Page directories/tables must start on a page boundary, hence the
 // "aligned" attribute.
@@ -21,6 +35,35 @@ pde_t entry_pgdir[NPDENTRIES] = {
 		= 0x000000 | PTE_P | PTE_PS,
 	// Map VA's [KERNBASE, KERNBASE+4MB) to PA's [0, 4MB)
 	[KERNBASE>>PDXSHIFT]
-		= 0x000000 | PTE_P | PTE_W | PTE_PS
+		= 0x000000 | PTE_P | PTE_W | PTE_PS | PTE_G
 };
 
+physaddr_t entry_map_top = PTSIZE;
+
+void
+entry_pgdir_map(void)
+{
+	// KERNBASE maps at most this much physical memory.
+	const uint64_t limit = 0x100000000ULL - KERNBASE;
+	struct e820_entry *e;
+	uint32_t i, pa, end;
+
+	for (i = 0; i < e820_map.nr; i++) {
+		e = &e820_map.entries[i];
+		if (e->type != E820_AVAILABLE || e->addr >= limit)
+			continue;
+		end = MIN(e->addr + e->len, limit);
+		for (pa = ROUNDDOWN((uint32_t) e->addr, PTSIZE); pa < end; pa += PTSIZE)
+			entry_pgdir[PDX(KERNBASE + pa)]
+				= pa | PTE_P | PTE_W | PTE_PS | PTE_G;
+		entry_map_top = MAX(entry_map_top, ROUNDUP(end, PTSIZE));
+	}
+
+	// Turning on PGE flushes the whole TLB, including any stale
+	// not-present entries; otherwise reload cr3 to do so.
+	if (cpuid_has_feature(CPUID_FEATURE_PGE))
+		lcr4(rcr4() | CR4_PGE);
+	else
+		lcr3(rcr3());
+}
+
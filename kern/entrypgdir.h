@@ -0,0 +1,18 @@
+#ifndef JOS_KERN_ENTRYPGDIR_H
+#define JOS_KERN_ENTRYPGDIR_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/memlayout.h>
+
+extern pde_t entry_pgdir[];
+
+// Physical addresses below entry_map_top that lie in available RAM are
+// mapped at KERNBASE by entry_pgdir, once entry_pgdir_map() has run.
+// Before that, only [0, 4MB) is.
+extern physaddr_t entry_map_top;
+
+void entry_pgdir_map(void);
+
+#endif	// !JOS_KERN_ENTRYPGDIR_H
@@ -1,7 +1,10 @@
 /* See COPYRIGHT for copyright information. */
 
+#include <inc/alternative.h>
 #include <inc/assert.h>
 #include <inc/cpuid.h>
+#include <inc/memlayout.h>
+#include <inc/mmu.h>
 #include <inc/multiboot.h>
 #include <inc/stdio.h>
 #include <inc/string.h>
@@ -9,6 +12,12 @@
 
 #include <kern/monitor.h>
 #include <kern/console.h>
+#include <kern/boottime.h>
+#include <kern/entrypgdir.h>
+#include <kern/kdebug.h>
+#include <kern/klog.h>
+#include <kern/trap.h>
+#include <kern/tsc.h>
 
 // Test the stack backtrace function (lab 1 only)
 void
@@ -21,19 +30,41 @@ test_backtrace(int x)
 		mon_backtrace(0, 0, 0);
 }
 
+// Enable SSE, if the CPU has it, so that memcpy can use it.  The
+// kernel never saves the SSE registers, so only code that can't be
+// interrupted while using them (string_init's choices) may use them.
+static void
+sse_init(void)
+{
+	if (!cpuid_has_feature(CPUID_FEATURE_FXSR)
+	    || !cpuid_has_feature(CPUID_FEATURE_SSE2))
+		return;
+	lcr0((rcr0() & ~CR0_EM) | CR0_MP);
+	lcr4(rcr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+}
+
 void
 i386_init(uint32_t magic, uint32_t addr)
 {
 	extern char edata[], end[];
+	struct multiboot_info *mbi = (struct multiboot_info *) addr;
+	uint64_t entry_tsc = read_tsc();
 
 	// Before doing anything else, complete the ELF loading process.
-	// Clear the uninitialized global data (BSS) section of our program.
+	// Clear the uninitialized global data (BSS) section of our program,
+	// unless the boot loader says it already did.
 	// This ensures that all static/global variables start out zero.
-	memset(edata, 0, end - edata);
+	if (magic != MULTIBOOT_BOOTLOADER_MAGIC
+	    || !(mbi->flags & MULTIBOOT_INFO_JOS_BSS))
+		memset(edata, 0, end - edata);
+
+	// Record how long the boot took so far, for 'boottime'.
+	boottime_init(entry_tsc, magic, mbi);
 
 	// Initialize the console.
 	// Can't call cprintf until after we do this!
 	cons_init();
+	boottime_stamp("kernel: cons_init");
 
 	// Must boot from Multiboot.
 	assert(magic == MULTIBOOT_BOOTLOADER_MAGIC);
@@ -41,15 +72,50 @@ i386_init(uint32_t magic, uint32_t addr)
 	cprintf("451 decimal is %o octal!\n", 451);
 
 	// Print CPU information.
+	cpuid_init();
+	cpu_topology_init();
 	cpuid_print();
+	boottime_stamp("kernel: cpuid_print");
+
+	// Patch in the best instructions for this CPU.
+	alternatives_apply();
+	boottime_stamp("kernel: alternatives_apply");
+
+	// Calibrate the TSC, for clock_ns().
+	tsc_init();
+	boottime_stamp("kernel: tsc_init");
+
+	// Check that the deferred-format log replays its records.
+	klog_selftest();
+
+	// Pick memcpy and memset variants for this CPU.
+	sse_init();
+	string_init();
 
 	// Initialize e820 memory map.
 	e820_init(addr);
+	boottime_stamp("kernel: e820_init");
+
+	// Map all of RAM at KERNBASE with large pages.
+	entry_pgdir_map();
+	cprintf("Direct map: [mem 0x00000000-0x%08x] at 0x%08x\n",
+		entry_map_top - 1, KERNBASE);
+	boottime_stamp("kernel: entry_pgdir_map");
+
+	// Take console input from interrupts.
+	trap_init();
+	boottime_stamp("kernel: trap_init");
+
+	// Index the stabs, for fast backtraces.
+	kdebug_init();
+	boottime_stamp("kernel: kdebug_init");
 
 	// Test the stack backtrace function (lab 1 only)
 	test_backtrace(5);
+	boottime_stamp("kernel: test_backtrace");
 
 	// Drop into the kernel monitor.
+	boottime_stamp("kernel: monitor");
 	while (1)
 		monitor(NULL);
 }
@@ -10,6 +10,25 @@ extern const struct Stab __STAB_END__[];	// End of stabs table
 extern const char __STABSTR_BEGIN__[];		// Beginning of string table
 extern const char __STABSTR_END__[];		// End of string table
 
+// The symbol index, built from the stabs by kdebug_init().  There is one
+// entry for every address at which the file or function containing an
+// address changes, sorted by address, so that debuginfo_eip() finds both
+// with one binary search instead of stab_binsearch()'s linear scans for
+// the right stab type.  An entry covers the addresses from 'addr' up to
+// the next entry's.
+#define KDEBUG_NSYM	1024
+
+struct kdebug_sym {
+	uintptr_t addr;
+	uint16_t file;		// N_SO stab of the file, or 0 for none
+	uint16_t fun;		// N_FUN stab of the function, or 0 for none
+	uint16_t end;		// last stab of the function, or of the file
+				// if there is no function (line table range)
+};
+
+static struct kdebug_sym syms[KDEBUG_NSYM];
+static int nsyms;
+
 
 // stab_binsearch(stabs, region_left, region_right, type, addr)
 //
@@ -94,6 +113,110 @@ stab_binsearch(const struct Stab *stabs, int *region_left, int *region_right,
 }
 
 
+static struct kdebug_sym *
+sym_add(uintptr_t addr, int file, int fun, int end)
+{
+	if (nsyms == KDEBUG_NSYM)
+		return NULL;
+	syms[nsyms].addr = addr;
+	syms[nsyms].file = file;
+	syms[nsyms].fun = fun;
+	syms[nsyms].end = end;
+	return &syms[nsyms++];
+}
+
+// The file-level entries of 'file' (all at the end of syms[], since
+// entries are added in stab order) end at stab 'end'.
+static void
+sym_end_file(int file, int end)
+{
+	int i;
+
+	for (i = nsyms - 1; i >= 0 && syms[i].file == file; i--)
+		if (!syms[i].fun)
+			syms[i].end = end;
+}
+
+// kdebug_init()
+//
+//	Build the symbol index from the kernel's stabs.  If the stabs don't
+//	fit in it, the index is left empty and debuginfo_eip() falls back to
+//	searching the stabs themselves.
+//
+void
+kdebug_init(void)
+{
+	const struct Stab *stabs = __STAB_BEGIN__;
+	const char *stabstr = __STABSTR_BEGIN__;
+	int n = __STAB_END__ - __STAB_BEGIN__;
+	struct kdebug_sym *fun = NULL, t;
+	int i, j, file = 0;
+	bool named;
+
+	if (n > 0xffff || __STABSTR_END__ <= stabstr || __STABSTR_END__[-1] != 0)
+		return;
+
+	for (i = 0; i < n; i++) {
+		named = stabs[i].n_strx && stabs[i].n_strx < __STABSTR_END__ - stabstr
+			&& stabstr[stabs[i].n_strx];
+		if (stabs[i].n_type == N_SO) {
+			// A new file, or (with an empty name) the end of one.
+			if (fun)
+				fun->end = i - 1;
+			fun = NULL;
+			sym_end_file(file, i - 1);
+			file = named ? i : 0;
+			if (!sym_add(stabs[i].n_value, file, 0, n - 1))
+				goto overflow;
+		} else if (stabs[i].n_type == N_FUN && named) {
+			if (fun)
+				fun->end = i - 1;
+			if (!(fun = sym_add(stabs[i].n_value, file, i, n - 1)))
+				goto overflow;
+		} else if (stabs[i].n_type == N_FUN && fun) {
+			// The end of a function, whose value is its size.  What
+			// follows is back in the file, outside any function.
+			fun->end = i - 1;
+			if (!sym_add(fun->addr + stabs[i].n_value, file, 0, n - 1))
+				goto overflow;
+			fun = NULL;
+		}
+	}
+	sym_end_file(file, n - 1);
+
+	// The stabs are in link order, which is nearly address order, so
+	// insertion sort is close to linear.  It is stable, too, so of
+	// entries at the same address the later stab wins, as it does
+	// for stab_binsearch().
+	for (i = 1; i < nsyms; i++) {
+		t = syms[i];
+		for (j = i; j > 0 && syms[j - 1].addr > t.addr; j--)
+			syms[j] = syms[j - 1];
+		syms[j] = t;
+	}
+	return;
+
+overflow:
+	nsyms = 0;
+}
+
+// The index entry covering 'addr', or NULL if 'addr' is below them all.
+static const struct kdebug_sym *
+sym_lookup(uintptr_t addr)
+{
+	int l = 0, r = nsyms, m;
+
+	while (l < r) {
+		m = (l + r) / 2;
+		if (syms[m].addr <= addr)
+			l = m + 1;
+		else
+			r = m;
+	}
+	return l ? &syms[l - 1] : NULL;
+}
+
+
 // debuginfo_eip(addr, info)
 //
 //	Fill in the 'info' structure with information about the specified
@@ -106,6 +229,7 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 {
 	const struct Stab *stabs, *stab_end;
 	const char *stabstr, *stabstr_end;
+	const struct kdebug_sym *sym;
 	int lfile, rfile, lfun, rfun, lline, rline;
 
 	// Initialize *info
@@ -136,18 +260,34 @@ debuginfo_eip(uintptr_t addr, struct Eipdebuginfo *info)
 	// Then, we look in that source file for the function.  Then we look
 	// for the line number.
 
-	// Search the entire set of stabs for the source file (type N_SO).
-	lfile = 0;
-	rfile = (stab_end - stabs) - 1;
-	stab_binsearch(stabs, &lfile, &rfile, N_SO, addr);
-	if (lfile == 0)
-		return -1;
+	// The symbol index gives both, if kdebug_init() built it.
+	if (nsyms > 0) {
+		if (!(sym = sym_lookup(addr)) || !sym->file)
+			return -1;
+		lfile = sym->file;
+		if (sym->fun) {
+			lfun = sym->fun;
+			rfun = sym->end;
+		} else {
+			rfile = sym->end;
+			lfun = 1;
+			rfun = 0;
+		}
+	} else {
+		// Search the entire set of stabs for the source file (type
+		// N_SO).
+		lfile = 0;
+		rfile = (stab_end - stabs) - 1;
+		stab_binsearch(stabs, &lfile, &rfile, N_SO, addr);
+		if (lfile == 0)
+			return -1;
 
-	// Search within that file's stabs for the function definition
-	// (N_FUN).
-	lfun = lfile;
-	rfun = rfile;
-	stab_binsearch(stabs, &lfun, &rfun, N_FUN, addr);
+		// Search within that file's stabs for the function
+		// definition (N_FUN).
+		lfun = lfile;
+		rfun = rfile;
+		stab_binsearch(stabs, &lfun, &rfun, N_FUN, addr);
+	}
 
 	if (lfun <= rfun) {
 		// stabs[lfun] points to the function name
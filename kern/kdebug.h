@@ -15,6 +15,7 @@ struct Eipdebuginfo {
 	int eip_fn_narg;		// Number of function arguments
 };
 
+void kdebug_init(void);
 int debuginfo_eip(uintptr_t eip, struct Eipdebuginfo *info);
 
 #endif
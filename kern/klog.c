@@ -0,0 +1,277 @@
+/* See COPYRIGHT for copyright information. */
+
+// Deferred-format kernel log.
+//
+// klog() takes a cprintf-style format but doesn't format anything: it
+// saves the format pointer, the TSC, and the first KLOG_NARGS words of
+// its arguments in a ring, so it is cheap enough for hot paths.  The
+// 'dmesg' monitor command formats the records later with vprintfmt(),
+// handing it the saved words as the va_list.  So the format string and
+// anything passed for %s must still be around then (string constants
+// are fine), and arguments beyond KLOG_NARGS words are lost.  Or
+// 'tracedump' sends the raw records to the host (see klog_export()).
+//
+// Boot phases (boottime_stamp()) and interrupts are logged.
+//
+// Writers claim a slot with an atomic increment of klog_next and never
+// wait; once the ring is full, the oldest records are overwritten.
+
+#include <inc/assert.h>
+#include <inc/stdio.h>
+#include <inc/stdarg.h>
+#include <inc/string.h>
+#include <inc/x86.h>
+
+#include <kern/klog.h>
+#include <kern/tsc.h>
+#include <kern/console.h>
+
+static struct klog_rec klog_ring[KLOG_SIZE];
+static uint32_t klog_next;	// sequence number of the next record
+
+// Compiled record formats for klog_print(), indexed by format pointer.
+// A few klog() sites usually account for most of the ring.
+#define KLOG_FMTCACHE	16
+static struct fmtdesc klog_fmtcache[KLOG_FMTCACHE];
+
+void
+klog(const char *fmt, ...)
+{
+	struct klog_rec *r;
+	va_list ap;
+	uint32_t seq;
+	int i;
+
+	seq = __sync_fetch_and_add(&klog_next, 1);
+	r = &klog_ring[seq % KLOG_SIZE];
+	r->seq = 0;
+	r->tsc = read_tsc();
+	r->fmt = fmt;
+	// Arguments are words on the stack on x86-32, so save the first
+	// few, whether or not the caller passed them.
+	va_start(ap, fmt);
+	for (i = 0; i < KLOG_NARGS; i++)
+		r->args[i] = va_arg(ap, uint32_t);
+	va_end(ap);
+	// Publish the record only once it's complete.
+	__sync_synchronize();
+	r->seq = seq + 1;
+}
+
+// Format and print every record in the ring, oldest first.
+void
+klog_print(void)
+{
+	struct klog_rec r;
+	uint32_t seq, next;
+	uint64_t us;
+
+	next = klog_next;
+	seq = (next > KLOG_SIZE ? next - KLOG_SIZE : 0);
+	if (next > KLOG_SIZE)
+		cprintf("(%u earlier records lost)\n", next - KLOG_SIZE);
+	for (; seq < next; seq++) {
+		// Copy the record, and skip it if a writer was at it.
+		r = klog_ring[seq % KLOG_SIZE];
+		if (r.seq != seq + 1)
+			continue;
+		us = tsc_to_ns(r.tsc) / 1000;
+		CPRINTF("[%5u.%06u] ", (uint32_t) (us / 1000000),
+			(uint32_t) (us % 1000000));
+		vcprintf_desc(&klog_fmtcache[((uintptr_t) r.fmt >> 2) % KLOG_FMTCACHE],
+			      r.fmt, (va_list) r.args);
+	}
+}
+
+// Check that a record replays as it would have formatted at the time,
+// for arguments of each size klog() saves.
+void
+klog_selftest(void)
+{
+	static const char fmt[] = "klog self-test %d %s %llx %c\n";
+	const struct klog_rec *r;
+	char buf[64];
+
+	klog(fmt, -42, "ok", 0x123456789abcULL, 'k');
+	r = &klog_ring[(klog_next - 1) % KLOG_SIZE];
+	assert(r->fmt == fmt);
+	vsnprintf(buf, sizeof(buf), r->fmt, (va_list) r->args);
+	assert(strcmp(buf, "klog self-test -42 ok 123456789abc k\n") == 0);
+}
+
+// Binary trace export for 'tracedump'.
+//
+// The ring goes out over COM1 as a series of frames, which the host
+// picks out of the captured serial output and decodes with
+// tracedecode.py.  Each frame is
+//
+//	"JTRC" type:u8 len:u16 payload[len] sum:u8
+//
+// with all integers little endian and 'sum' making the payload bytes
+// add up to 0 mod 256.  A dump is one TRACE_HEADER, then each format
+// string as a TRACE_STRING, and each string a %s argument points to as
+// a TRACE_ARGSTR, before the first TRACE_RECORD that uses it, then one
+// TRACE_END.
+
+#define TRACE_VERSION	1
+
+enum {
+	TRACE_HEADER = 1,	// struct trace_header
+	TRACE_STRING,		// id:u16, then the string, without its NUL
+	TRACE_RECORD,		// struct trace_record
+	TRACE_END,		// number of records:u32
+	TRACE_ARGSTR,		// address:u32, then the string, without its NUL
+};
+
+struct trace_header {
+	uint32_t version;
+	uint32_t tsc_khz;
+	uint32_t ncpu;
+} __attribute__((packed));
+
+struct trace_record {
+	uint64_t tsc;
+	uint8_t cpu;
+	uint8_t nargs;
+	uint16_t event;		// id of the format string
+	uint32_t args[KLOG_NARGS];
+} __attribute__((packed));
+
+static void
+trace_frame(uint8_t type, const void *payload, uint16_t len)
+{
+	const uint8_t *p = payload;
+	uint8_t hdr[7] = { 'J', 'T', 'R', 'C', type, len & 0xFF, len >> 8 };
+	uint8_t sum = 0;
+	int i;
+
+	for (i = 0; i < len; i++)
+		sum -= p[i];
+	serial_send(hdr, sizeof(hdr));
+	serial_send(payload, len);
+	serial_send(&sum, 1);
+}
+
+// Call 'f' with the address of each string that a %s conversion of
+// 'r' takes, as far as r->args goes.
+static void
+trace_argstrs(const struct klog_rec *r, void (*f)(const char *))
+{
+	const char *p;
+	int arg, lflag;
+
+	for (p = r->fmt, arg = 0; *p && arg < KLOG_NARGS; p++) {
+		if (*p != '%')
+			continue;
+		lflag = 0;
+		for (p++; *p == '-' || *p == '0' || *p == '#' || *p == '.'
+			  || *p == '*' || *p == 'l' || (*p >= '1' && *p <= '9');
+		     p++) {
+			if (*p == '*')
+				arg++;
+			else if (*p == 'l')
+				lflag++;
+		}
+		switch (*p) {
+		case '\0':
+			return;
+		case '%':
+			break;
+		case 's':
+			if (arg < KLOG_NARGS && r->args[arg])
+				f((const char *) r->args[arg]);
+			arg++;
+			break;
+		case 'd':
+		case 'u':
+		case 'o':
+		case 'x':
+			arg += (lflag >= 2 ? 2 : 1);
+			break;
+		default:
+			arg++;
+			break;
+		}
+	}
+}
+
+// %s strings sent so far in this dump.
+static const char *trace_sent[KLOG_SIZE];
+static int trace_nsent;
+
+// Send the string at 's' as a TRACE_ARGSTR, unless it went already.
+static void
+trace_argstr(const char *s)
+{
+	struct {
+		uint32_t addr;
+		char text[256];
+	} __attribute__((packed)) str;
+	size_t len;
+	int i;
+
+	for (i = 0; i < trace_nsent && trace_sent[i] != s; i++)
+		/* do nothing */;
+	if (i < trace_nsent)
+		return;
+	if (trace_nsent < KLOG_SIZE)
+		trace_sent[trace_nsent++] = s;
+	len = strnlen(s, sizeof(str.text));
+	str.addr = (uint32_t) s;
+	memcpy(str.text, s, len);
+	trace_frame(TRACE_ARGSTR, &str, sizeof(str.addr) + len);
+}
+
+// Send every record in the ring to the host; return how many.
+int
+klog_export(void)
+{
+	static const char *strs[KLOG_SIZE];
+	struct {
+		uint16_t id;
+		char text[256];
+	} __attribute__((packed)) str;
+	struct trace_header hdr;
+	struct trace_record tr;
+	struct klog_rec r;
+	uint32_t seq, next, n;
+	int id, nstrs;
+	size_t len;
+
+	hdr.version = TRACE_VERSION;
+	hdr.tsc_khz = tsc_khz();
+	hdr.ncpu = 1;
+	trace_frame(TRACE_HEADER, &hdr, sizeof(hdr));
+
+	nstrs = 0;
+	trace_nsent = 0;
+	n = 0;
+	next = klog_next;
+	for (seq = (next > KLOG_SIZE ? next - KLOG_SIZE : 0); seq < next; seq++) {
+		r = klog_ring[seq % KLOG_SIZE];
+		if (r.seq != seq + 1)
+			continue;
+
+		for (id = 0; id < nstrs && strs[id] != r.fmt; id++)
+			/* do nothing */;
+		if (id == nstrs) {
+			strs[nstrs++] = r.fmt;
+			len = strnlen(r.fmt, sizeof(str.text));
+			str.id = id;
+			memcpy(str.text, r.fmt, len);
+			trace_frame(TRACE_STRING, &str, sizeof(str.id) + len);
+		}
+		trace_argstrs(&r, trace_argstr);
+
+		tr.tsc = r.tsc;
+		tr.cpu = 0;		// no SMP yet
+		tr.nargs = KLOG_NARGS;
+		tr.event = id;
+		memcpy(tr.args, r.args, sizeof(tr.args));
+		trace_frame(TRACE_RECORD, &tr, sizeof(tr));
+		n++;
+	}
+
+	trace_frame(TRACE_END, &n, sizeof(n));
+	return n;
+}
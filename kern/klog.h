@@ -0,0 +1,27 @@
+#ifndef JOS_KERN_KLOG_H
+#define JOS_KERN_KLOG_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+// Number of argument words saved per record
+#define KLOG_NARGS	6
+// Number of records in the ring (a power of 2)
+#define KLOG_SIZE	256
+
+// One klog() call, formatted later.
+struct klog_rec {
+	uint32_t seq;			// sequence number + 1, 0 if unused
+	const char *fmt;
+	uint64_t tsc;
+	uint32_t args[KLOG_NARGS];	// raw argument words
+};
+
+void klog(const char *fmt, ...);
+void klog_print(void);
+void klog_selftest(void);
+int klog_export(void);
+
+#endif	// !JOS_KERN_KLOG_H
@@ -5,11 +5,16 @@
 #include <inc/string.h>
 #include <inc/memlayout.h>
 #include <inc/assert.h>
+#include <inc/cpuid.h>
 #include <inc/x86.h>
 
 #include <kern/console.h>
 #include <kern/monitor.h>
 #include <kern/kdebug.h>
+#include <kern/boottime.h>
+#include <kern/klog.h>
+#include <kern/bench.h>
+#include <kern/tsc.h>
 
 #define CMDBUF_SIZE	80	// enough for one VGA text line
 
@@ -24,6 +29,13 @@ struct Command {
 static struct Command commands[] = {
 	{ "help", "Display this list of commands", mon_help },
 	{ "kerninfo", "Display information about the kernel", mon_kerninfo },
+	{ "boottime", "Display the boot timeline", mon_boottime },
+	{ "uptime", "Display the time since reset", mon_uptime },
+	{ "topology", "Display CPU caches and topology", mon_topology },
+	{ "console", "Display or set console outputs: console [name on|off]", mon_console },
+	{ "dmesg", "Display the kernel log", mon_dmesg },
+	{ "tracedump", "Send the kernel log to COM1 in binary (see tracedecode.py)", mon_tracedump },
+	{ "bench", "Run microbenchmarks: bench [name] [iters]", mon_bench },
 };
 
 /***** Implementations of basic kernel monitor commands *****/
@@ -54,6 +66,96 @@ mon_kerninfo(int argc, char **argv, struct Trapframe *tf)
 	return 0;
 }
 
+int
+mon_boottime(int argc, char **argv, struct Trapframe *tf)
+{
+	boottime_print();
+	return 0;
+}
+
+int
+mon_uptime(int argc, char **argv, struct Trapframe *tf)
+{
+	uint64_t us = clock_ns() / 1000;
+	uint32_t khz = tsc_khz();
+
+	cprintf("up %llu.%06us (TSC %u.%03u MHz, from %s)\n",
+		us / 1000000, (uint32_t) (us % 1000000),
+		khz / 1000, khz % 1000, tsc_source());
+	return 0;
+}
+
+int
+mon_topology(int argc, char **argv, struct Trapframe *tf)
+{
+	cpu_topology_print();
+	return 0;
+}
+
+int
+mon_console(int argc, char **argv, struct Trapframe *tf)
+{
+	if (argc == 3 && (strcmp(argv[2], "on") == 0 || strcmp(argv[2], "off") == 0)) {
+		if (cons_sink_enable(argv[1], strcmp(argv[2], "on") == 0) < 0)
+			cprintf("No console output '%s'\n", argv[1]);
+		return 0;
+	}
+	if (argc != 1) {
+		cprintf("Usage: console [name on|off]\n");
+		return 0;
+	}
+	cons_sink_print();
+	return 0;
+}
+
+int
+mon_dmesg(int argc, char **argv, struct Trapframe *tf)
+{
+	klog_print();
+	return 0;
+}
+
+int
+mon_tracedump(int argc, char **argv, struct Trapframe *tf)
+{
+	int n;
+
+	n = klog_export();
+	cprintf("\ntracedump: sent %d records\n", n);
+	return 0;
+}
+
+int
+mon_bench(int argc, char **argv, struct Trapframe *tf)
+{
+	const char *name = NULL;
+	char *end;
+	int iters = 1000;
+
+	if (argc > 1) {
+		iters = strtol(argv[argc - 1], &end, 0);
+		if (*end == '\0')
+			argc--;
+		else
+			iters = 1000;
+	}
+	if (argc > 2 || iters <= 0) {
+		cprintf("Usage: bench [name] [iters]\n");
+		return 0;
+	}
+	if (bench_count() == 0) {
+		cprintf("No benchmarks are registered\n");
+		return 0;
+	}
+	if (argc > 1)
+		name = argv[1];
+	if (bench_run(name, iters) == 0) {
+		cprintf("Unknown benchmark '%s'; there are:\n", argv[1]);
+		bench_list();
+	}
+	return 0;
+}
+
 int
 mon_backtrace(int argc, char **argv, struct Trapframe *tf)
 {
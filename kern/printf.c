@@ -1,24 +1,81 @@
 // Simple implementation of cprintf console output for the kernel,
-// based on printfmt() and the kernel console's cputchar().
+// based on vprintfmt_buf() and the kernel console's cons_write().
+// Output is collected in a buffer on the stack and written to the
+// console in chunks, rather than one character at a time.
 
 #include <inc/types.h>
 #include <inc/stdio.h>
 #include <inc/stdarg.h>
+#include <inc/string.h>
 
+#include <kern/console.h>
+
+struct printbuf {
+	int idx;	// current buffer index
+	int cnt;	// total bytes printed so far
+	char buf[256];
+};
 
 static void
-putch(int ch, int *cnt)
+putbuf(const char *s, size_t n, struct printbuf *b)
 {
-	cputchar(ch);
-	*cnt++;
+	b->cnt += n;
+	if (b->idx + n > sizeof(b->buf)) {
+		cons_write(b->buf, b->idx);
+		b->idx = 0;
+		// Too big to be worth copying
+		if (n > sizeof(b->buf) / 2) {
+			cons_write(s, n);
+			return;
+		}
+	}
+	memcpy(b->buf + b->idx, s, n);
+	b->idx += n;
 }
 
 int
 vcprintf(const char *fmt, va_list ap)
 {
-	int cnt = 0;
+	struct printbuf b;
+
+	b.idx = 0;
+	b.cnt = 0;
+	vprintfmt_buf((void*)putbuf, &b, fmt, ap);
+	cons_write(b.buf, b.idx);
+
+	return b.cnt;
+}
+
+// Like vcprintf, but use (and on first use fill in) the compiled
+// format 'd'.
+int
+vcprintf_desc(struct fmtdesc *d, const char *fmt, va_list ap)
+{
+	struct printbuf b;
+
+	if (d->fmt != fmt)
+		fmt_compile(d, fmt);
+	if (d->nspec < 0)
+		return vcprintf(fmt, ap);
+
+	b.idx = 0;
+	b.cnt = 0;
+	vprintfmt_desc((void*)putbuf, &b, d, ap);
+	cons_write(b.buf, b.idx);
+
+	return b.cnt;
+}
+
+int
+cprintf_desc(struct fmtdesc *d, const char *fmt, ...)
+{
+	va_list ap;
+	int cnt;
+
+	va_start(ap, fmt);
+	cnt = vcprintf_desc(d, fmt, ap);
+	va_end(ap);
 
-	vprintfmt((void*)putch, &cnt, fmt, ap);
 	return cnt;
 }
 
@@ -0,0 +1,96 @@
+/* See COPYRIGHT for copyright information. */
+
+#include <inc/mmu.h>
+#include <inc/memlayout.h>
+#include <inc/x86.h>
+#include <inc/assert.h>
+
+#include <kern/trap.h>
+#include <kern/console.h>
+#include <kern/klog.h>
+#include <kern/picirq.h>
+
+bool trap_ready;
+
+// Global descriptor table.  The boot loader's GDT lives in the boot
+// sector, at a low address the kernel reaches only through the
+// identity map, so the kernel installs its own before taking
+// interrupts.
+struct Segdesc gdt[] =
+{
+	// 0x0 - unused (always faults -- for trapping NULL far pointers)
+	SEG_NULL,
+
+	// 0x8 - kernel code segment
+	[GD_KT >> 3] = SEG(STA_X | STA_R, 0x0, 0xffffffff, 0),
+
+	// 0x10 - kernel data segment
+	[GD_KD >> 3] = SEG(STA_W, 0x0, 0xffffffff, 0),
+};
+
+struct Pseudodesc gdt_pd = {
+	sizeof(gdt) - 1, (uint32_t) gdt
+};
+
+/* Interrupt descriptor table.  (Must be built at run time because
+ * shifted function addresses can't be represented in relocation records.)
+ */
+struct Gatedesc idt[256] = { { 0 } };
+struct Pseudodesc idt_pd = {
+	sizeof(idt) - 1, (uint32_t) idt
+};
+
+
+// Load the kernel's GDT and reload all the segment registers from it.
+static void
+gdt_init(void)
+{
+	lgdt(&gdt_pd);
+	asm volatile("movw %%ax,%%gs" : : "a" (GD_KD));
+	asm volatile("movw %%ax,%%fs" : : "a" (GD_KD));
+	asm volatile("movw %%ax,%%es" : : "a" (GD_KD));
+	asm volatile("movw %%ax,%%ds" : : "a" (GD_KD));
+	asm volatile("movw %%ax,%%ss" : : "a" (GD_KD));
+	// Reload CS with a far jump.
+	asm volatile("ljmp %0,$1f\n 1:\n" : : "i" (GD_KT));
+}
+
+// Switch to the kernel's GDT, set up interrupt gates for the hardware
+// interrupts and route them there.
+void
+trap_init(void)
+{
+	extern uint32_t irq_handlers[];
+	int i;
+
+	gdt_init();
+	for (i = 0; i < MAX_IRQS; i++)
+		SETGATE(idt[IRQ_OFFSET + i], 0, GD_KT, irq_handlers[i], 0);
+	lidt(&idt_pd);
+
+	pic_init();
+	trap_ready = 1;
+}
+
+void
+trap(struct Trapframe *tf)
+{
+	klog("irq %d\n", tf->tf_trapno - IRQ_OFFSET);
+	switch (tf->tf_trapno) {
+	case IRQ_OFFSET + IRQ_KBD:
+		kbd_intr();
+		break;
+	case IRQ_OFFSET + IRQ_SERIAL:
+		serial_intr();
+		break;
+	case IRQ_OFFSET + IRQ_SPURIOUS:
+		// The 8259A raises IRQ 7 for an interrupt that went away
+		// before it was acknowledged; there's nothing to do.
+		break;
+	default:
+		// The master PIC is in automatic EOI mode, but the slave
+		// isn't; we never unmask its IRQs.
+		cprintf("Unexpected interrupt %d\n", tf->tf_trapno - IRQ_OFFSET);
+		break;
+	}
+}
@@ -0,0 +1,19 @@
+/* See COPYRIGHT for copyright information. */
+
+#ifndef JOS_KERN_TRAP_H
+#define JOS_KERN_TRAP_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/trap.h>
+#include <inc/mmu.h>
+
+// Set once the IDT is loaded and the PICs are remapped, so that it is
+// safe to enable interrupts.
+extern bool trap_ready;
+
+void trap_init(void);
+void trap(struct Trapframe *tf);
+
+#endif /* JOS_KERN_TRAP_H */
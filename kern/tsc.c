@@ -0,0 +1,152 @@
+/* See COPYRIGHT for copyright information. */
+
+// TSC calibration and timekeeping.
+//
+// The TSC frequency comes from CPUID leaf 0x15 (TSC/crystal ratio and
+// crystal frequency) when the CPU reports both, else from leaf 0x16
+// (base frequency, which the TSC runs at on the CPUs that have the
+// leaf but no crystal frequency), else from counting TSC cycles over
+// 10ms of the PIT.  If all of those fail, the frequency stays unknown
+// (tsc_khz() returns 0).  clock_ns() then turns TSC readings into
+// nanoseconds with a multiply and a shift, no division.
+
+#include <inc/x86.h>
+
+#include <kern/tsc.h>
+
+// 8253/8254 programmable interval timer
+#define PIT_HZ		1193182
+#define PIT_CH2		0x42	// Channel 2 data port
+#define PIT_MODE	0x43	// Mode/command register
+#define   PIT_SEL2	0x80	//   Select channel 2
+#define   PIT_RW_16	0x30	//   Access low byte, then high byte
+#define   PIT_MODE0	0x00	//   Interrupt on terminal count
+#define PIT_CTRL	0x61	// Keyboard controller port B
+#define   PIT_GATE2	0x01	//   Channel 2 gate
+#define   PIT_SPKR	0x02	//   Speaker data enable
+#define   PIT_OUT2	0x20	//   Channel 2 output (read only)
+
+#define CALIBRATE_MS	10
+// Give up on the PIT after this many polls of port 0x61, about a
+// second on hardware, where each takes a microsecond or so.
+#define CALIBRATE_MAX_POLLS	1000000
+
+static uint32_t khz;
+static const char *khz_source = "none";
+static bool calibrated;		// tsc_init() ran, whether or not it worked
+
+// ns = cycles * clock_mult >> clock_shift
+static uint32_t clock_mult;
+static uint32_t clock_shift;
+
+// TSC frequency in kHz from CPUID, or 0 if the CPU doesn't say.
+static uint32_t
+cpuid_calibrate(void)
+{
+	uint32_t max, den, num, crystal, base;
+
+	cpuid(0, &max, NULL, NULL, NULL);
+	if (max >= 0x15) {
+		cpuid(0x15, &den, &num, &crystal, NULL);
+		if (den && num && crystal) {
+			khz_source = "cpuid 0x15";
+			return (uint64_t) crystal * num / den / 1000;
+		}
+	}
+	if (max >= 0x16) {
+		cpuid(0x16, &base, NULL, NULL, NULL);
+		if (base) {
+			khz_source = "cpuid 0x16";
+			return (base & 0xFFFF) * 1000;
+		}
+	}
+	return 0;
+}
+
+// Count TSC cycles while PIT channel 2 counts down CALIBRATE_MS.
+// Channel 2's gate and output are wired to port 0x61 rather than to the
+// interrupt controller, so we can poll it with interrupts off.  Returns
+// 0 if OUT2 never goes high, as on machines without a working PIT.
+static uint32_t
+pit_calibrate(void)
+{
+	uint32_t latch = PIT_HZ / (1000 / CALIBRATE_MS);
+	uint64_t t0, t1;
+	int i;
+
+	// Gate high, speaker off.
+	outb(PIT_CTRL, (inb(PIT_CTRL) & ~PIT_SPKR) | PIT_GATE2);
+
+	// Mode 0: OUT2 goes high when the count reaches zero.
+	outb(PIT_MODE, PIT_SEL2 | PIT_RW_16 | PIT_MODE0);
+	outb(PIT_CH2, latch & 0xFF);
+	outb(PIT_CH2, latch >> 8);
+
+	t0 = read_tsc();
+	for (i = 0; !(inb(PIT_CTRL) & PIT_OUT2); i++)
+		if (i == CALIBRATE_MAX_POLLS)
+			return 0;
+	t1 = read_tsc();
+
+	return (t1 - t0) / CALIBRATE_MS;
+}
+
+// Calibrate the TSC and set up clock_ns().
+void
+tsc_init(void)
+{
+	uint64_t mult;
+
+	calibrated = true;
+	if ((khz = cpuid_calibrate()) == 0
+	    && (khz = pit_calibrate()) != 0)
+		khz_source = "pit";
+	if (!khz)
+		return;
+
+	// Nanoseconds per cycle is 1000000 / khz.  Take the largest shift
+	// for which the multiplier still fits in 32 bits.
+	for (clock_shift = 32; clock_shift > 0; clock_shift--) {
+		mult = (1000000ULL << clock_shift) / khz;
+		if (mult <= 0xFFFFFFFF)
+			break;
+	}
+	clock_mult = mult;
+}
+
+uint32_t
+tsc_khz(void)
+{
+	if (!calibrated)
+		tsc_init();
+	return khz;
+}
+
+// Where tsc_khz() came from: "cpuid 0x15", "cpuid 0x16", "pit", or
+// "none" if it is unknown.
+const char *
+tsc_source(void)
+{
+	tsc_khz();
+	return khz_source;
+}
+
+// Convert TSC cycles to nanoseconds.  The 64x32-bit product is split
+// in two so that it can't overflow for any plausible uptime.
+uint64_t
+tsc_to_ns(uint64_t cycles)
+{
+	uint32_t hi = cycles >> 32, lo = cycles;
+
+	if (!clock_mult && !tsc_khz())
+		return 0;
+	return (((uint64_t) hi * clock_mult) << (32 - clock_shift))
+		+ (((uint64_t) lo * clock_mult) >> clock_shift);
+}
+
+// Nanoseconds since the TSC started counting, at reset.
+uint64_t
+clock_ns(void)
+{
+	return tsc_to_ns(read_tsc());
+}
@@ -0,0 +1,18 @@
+#ifndef JOS_KERN_TSC_H
+#define JOS_KERN_TSC_H
+#ifndef JOS_KERNEL
+# error "This is a JOS kernel header; user programs should not #include it"
+#endif
+
+#include <inc/types.h>
+
+void tsc_init(void);
+
+// TSC frequency in kHz, calibrated on first use, and how it was found.
+uint32_t tsc_khz(void);
+const char *tsc_source(void);
+
+uint64_t tsc_to_ns(uint64_t cycles);
+uint64_t clock_ns(void);
+
+#endif	// !JOS_KERN_TSC_H
@@ -1,6 +1,7 @@
 #include <inc/assert.h>
 #include <inc/cpuid.h>
 #include <inc/stdio.h>
+#include <inc/string.h>
 #include <inc/x86.h>
 
 static const char *names[CPUID_BIT(CPUID_NR_FLAGS, 0)] = {
@@ -69,6 +70,24 @@ static const char *names[CPUID_BIT(CPUID_NR_FLAGS, 0)] = {
 	[CPUID_FEATURE_RDRAND]		= "rdrand",
 	[CPUID_FEATURE_HYPERVISOR]	= "hypervisor",
 
+	// CPUID(7, 0): EBX
+	[CPUID_FEATURE_FSGSBASE]	= "fsgsbase",
+	[CPUID_FEATURE_TSC_ADJUST]	= "tsc_adjust",
+	[CPUID_FEATURE_BMI1]		= "bmi1",
+	[CPUID_FEATURE_HLE]		= "hle",
+	[CPUID_FEATURE_AVX2]		= "avx2",
+	[CPUID_FEATURE_SMEP]		= "smep",
+	[CPUID_FEATURE_BMI2]		= "bmi2",
+	[CPUID_FEATURE_ERMS]		= "erms",
+	[CPUID_FEATURE_INVPCID]		= "invpcid",
+	[CPUID_FEATURE_RTM]		= "rtm",
+	[CPUID_FEATURE_RDSEED]		= "rdseed",
+	[CPUID_FEATURE_ADX]		= "adx",
+	[CPUID_FEATURE_SMAP]		= "smap",
+	[CPUID_FEATURE_CLFLUSHOPT]	= "clflushopt",
+	[CPUID_FEATURE_CLWB]		= "clwb",
+	[CPUID_FEATURE_SHA]		= "sha_ni",
+
 	// CPUID(0x80000001): EDX
 	[CPUID_FEATURE_SYSCALL]		= "syscall",
 	[CPUID_FEATURE_MP]		= "mp",
@@ -125,16 +144,62 @@ print_feature(uint32_t *feature)
 	}
 }
 
-static bool
-cpuid_has(uint32_t *feature, unsigned int bit)
+// Read feature word 'word' (CPUID_1_EDX etc.) from the CPU.
+static uint32_t
+cpuid_word(unsigned int word)
+{
+	uint32_t max, r = 0;
+
+	switch (word) {
+	case CPUID_1_EDX:
+		cpuid(1, NULL, NULL, NULL, &r);
+		break;
+	case CPUID_1_ECX:
+		cpuid(1, NULL, NULL, &r, NULL);
+		break;
+	case CPUID_7_EBX:
+		cpuid(0, &max, NULL, NULL, NULL);
+		if (max >= 7)
+			cpuid(7, NULL, &r, NULL, NULL);
+		break;
+	case CPUID_80000001_EDX:
+		cpuid(0x80000001, NULL, NULL, NULL, &r);
+		break;
+	case CPUID_80000001_ECX:
+		cpuid(0x80000001, NULL, NULL, &r, NULL);
+		break;
+	}
+	return r;
+}
+
+// The CPU's feature words, indexed by CPUID_1_EDX etc.  Filled in once
+// by cpuid_init(); read-only after that.
+uint32_t cpu_features[CPUID_NR_FLAGS];
+static bool cpu_features_ready;
+
+void
+cpuid_init(void)
+{
+	int i;
+
+	for (i = 0; i < CPUID_NR_FLAGS; i++)
+		cpu_features[i] = cpuid_word(i);
+	cpu_features_ready = true;
+}
+
+// Does the CPU have the feature 'bit' (a CPUID_FEATURE_*)?
+bool
+cpuid_has_feature(unsigned int bit)
 {
-	return feature[bit / 32] & BIT(bit % 32);
+	if (!cpu_features_ready)
+		cpuid_init();
+	return cpu_features[bit / 32] & BIT(bit % 32);
 }
 
 void
 cpuid_print(void)
 {
-	uint32_t eax, brand[12], feature[CPUID_NR_FLAGS] = {0};
+	uint32_t eax, brand[12];
 
 	cpuid(0x80000000, &eax, NULL, NULL, NULL);
 	if (eax < 0x80000004)
@@ -145,12 +210,166 @@ cpuid_print(void)
 	cpuid(0x80000004, &brand[8], &brand[9], &brand[10], &brand[11]);
 	cprintf("CPU: %.48s\n", brand);
 
-	cpuid(1, NULL, NULL,
-	      &feature[CPUID_1_ECX], &feature[CPUID_1_EDX]);
-	cpuid(0x80000001, NULL, NULL,
-	      &feature[CPUID_80000001_ECX], &feature[CPUID_80000001_EDX]);
-	print_feature(feature);
+	if (!cpu_features_ready)
+		cpuid_init();
+	print_feature(cpu_features);
 	// Check feature bits.
-	assert(cpuid_has(feature, CPUID_FEATURE_PSE));
-	assert(cpuid_has(feature, CPUID_FEATURE_APIC));
+	assert(cpuid_has_feature(CPUID_FEATURE_PSE));
+	assert(cpuid_has_feature(CPUID_FEATURE_APIC));
+}
+
+// Caches and topology
+
+struct cpu_topology cpu_topology;
+
+// Read the cache descriptors from 'leaf' (4 or 0x8000001D), which
+// share a layout.
+static void
+cache_init(uint32_t leaf)
+{
+	struct cpu_cache *c;
+	uint32_t i, eax, ebx, ecx;
+
+	for (i = 0; cpu_topology.ncache < CPU_CACHE_MAX; i++) {
+		cpuid_count(leaf, i, &eax, &ebx, &ecx, NULL);
+		if ((eax & 0x1F) == 0)
+			break;
+		c = &cpu_topology.cache[cpu_topology.ncache++];
+		c->type = eax & 0x1F;
+		c->level = (eax >> 5) & 0x7;
+		c->sharing = ((eax >> 14) & 0xFFF) + 1;
+		c->line_size = (ebx & 0xFFF) + 1;
+		c->ways = (ebx >> 22) + 1;
+		c->sets = ecx + 1;
+		c->size = c->ways * (((ebx >> 12) & 0x3FF) + 1)
+			* c->line_size * c->sets;
+		if (c->level == 1 && c->type != CPU_CACHE_INST)
+			cpu_topology.line_size = c->line_size;
+	}
+}
+
+// Decode topology leaf 'leaf' (0x1F or 0xB).  Returns false, leaving
+// the topology fields clear, if the CPU doesn't really implement it.
+static bool
+topology_leaf(uint32_t leaf)
+{
+	struct cpu_topology *t = &cpu_topology;
+	uint32_t i, eax, ebx, ecx, edx, type;
+
+	for (i = 0; ; i++) {
+		cpuid_count(leaf, i, &eax, &ebx, &ecx, &edx);
+		type = (ecx >> 8) & 0xFF;
+		if (type == 0)
+			break;
+		// 1 = SMT; the last level reports the whole package.
+		if (type == 1) {
+			t->smt_shift = eax & 0x1F;
+			t->threads_per_core = ebx & 0xFFFF;
+		}
+		t->pkg_shift = eax & 0x1F;
+		t->threads_per_pkg = ebx & 0xFFFF;
+		t->apic_id = edx;
+	}
+	if (i == 0 || !t->threads_per_pkg) {
+		t->smt_shift = t->pkg_shift = 0;
+		t->threads_per_core = t->threads_per_pkg = 0;
+		t->apic_id = 0;
+		return false;
+	}
+	t->leaf = leaf;
+	return true;
+}
+
+static uint32_t
+log2_ceil(uint32_t n)
+{
+	uint32_t s = 0;
+
+	while ((1U << s) < n)
+		s++;
+	return s;
+}
+
+void
+cpu_topology_init(void)
+{
+	struct cpu_topology *t = &cpu_topology;
+	uint32_t max, maxext, vendor, eax, ebx, ecx;
+
+	memset(t, 0, sizeof(*t));
+	cpuid(0, &max, &vendor, NULL, NULL);
+	cpuid(0x80000000, &maxext, NULL, NULL, NULL);
+	cpuid(1, NULL, &ebx, NULL, NULL);
+	t->clflush_size = ((ebx >> 8) & 0xFF) * 8;
+
+	if (cpuid_has_feature(CPUID_FEATURE_TOPOEXT))
+		cache_init(0x8000001D);
+	else if (max >= 4)
+		cache_init(4);
+	if (!t->line_size)
+		t->line_size = t->clflush_size ? t->clflush_size : 64;
+
+	if (!(max >= 0x1F && topology_leaf(0x1F))
+	    && !(max >= 0xB && topology_leaf(0xB))) {
+		// Leaf 1: logical processors per package (if HT), and
+		// the initial APIC ID.  Cores per package come from leaf
+		// 0x80000008 on AMD ("Auth" of "AuthenticAMD"), where
+		// leaf 4 is reserved, and from leaf 4 elsewhere.
+		t->apic_id = ebx >> 24;
+		t->threads_per_pkg = 1;
+		if (cpuid_has_feature(CPUID_FEATURE_HT))
+			t->threads_per_pkg = (ebx >> 16) & 0xFF;
+		t->cores_per_pkg = 1;
+		if (vendor == 0x68747541 && maxext >= 0x80000008) {
+			cpuid(0x80000008, NULL, NULL, &ecx, NULL);
+			t->cores_per_pkg = (ecx & 0xFF) + 1;
+			t->leaf = 0x80000008;
+			// With TOPOEXT, that is a count of threads.
+			if (cpuid_has_feature(CPUID_FEATURE_TOPOEXT)) {
+				cpuid(0x8000001E, NULL, &ebx, NULL, NULL);
+				t->cores_per_pkg /= ((ebx >> 8) & 0xFF) + 1;
+			}
+		} else if (max >= 4) {
+			cpuid_count(4, 0, &eax, NULL, NULL, NULL);
+			t->cores_per_pkg = (eax >> 26) + 1;
+			t->leaf = 4;
+		}
+		if (t->threads_per_pkg < t->cores_per_pkg)
+			t->threads_per_pkg = t->cores_per_pkg;
+		t->threads_per_core = t->threads_per_pkg / t->cores_per_pkg;
+		t->smt_shift = log2_ceil(t->threads_per_core);
+		t->pkg_shift = log2_ceil(t->threads_per_pkg);
+	}
+	if (!t->threads_per_core)
+		t->threads_per_core = 1;
+	t->cores_per_pkg = t->threads_per_pkg / t->threads_per_core;
+}
+
+void
+cpu_topology_print(void)
+{
+	static const char type[] = "?diu";
+	const struct cpu_topology *t = &cpu_topology;
+	const struct cpu_cache *c;
+	int i;
+
+	for (i = 0; i < t->ncache; i++) {
+		c = &t->cache[i];
+		cprintf("L%d%c %6uK %2u-way %3uB lines %5u sets, shared by %u\n",
+			c->level, c->type < 4 ? type[c->type] : '?',
+			c->size / 1024, c->ways, c->line_size, c->sets,
+			c->sharing);
+	}
+	cprintf("Cache line %u bytes, CLFLUSH line %u bytes\n",
+		t->line_size, t->clflush_size);
+	cprintf("%u threads/core, %u cores/package, APIC ID %u "
+		"(SMT bits %u, core bits %u)",
+		t->threads_per_core, t->cores_per_pkg, t->apic_id,
+		t->smt_shift, t->pkg_shift - t->smt_shift);
+	if (t->leaf == 0x1F || t->leaf == 0xB)
+		cprintf(", from CPUID 0x%x\n", t->leaf);
+	else if (t->leaf)
+		cprintf(", from CPUID 1 and 0x%x\n", t->leaf);
+	else
+		cprintf(", from CPUID 1\n");
 }
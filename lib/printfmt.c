@@ -28,25 +28,112 @@ static const char * const error_string[MAXERROR] =
 	[E_FAULT]	= "segmentation fault",
 };
 
+static const char digits[] = "0123456789abcdef";
+
+// "00" through "99", for converting two decimal digits at a time.
+static const char digits2[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+// Convert the 32-bit 'n' to decimal, ending just before 'p'.
+// Return a pointer to the first digit.
+static char *
+utoa10(char *p, uint32_t n)
+{
+	uint32_t q;
+
+	while (n >= 100) {
+		q = n / 100;
+		p -= 2;
+		p[0] = digits2[(n - q * 100) * 2];
+		p[1] = digits2[(n - q * 100) * 2 + 1];
+		n = q;
+	}
+	if (n >= 10) {
+		p -= 2;
+		p[0] = digits2[n * 2];
+		p[1] = digits2[n * 2 + 1];
+	} else
+		*--p = '0' + n;
+	return p;
+}
+
+// Output 'n' copies of 'c'.
+static void
+putpad(void (*putbuf)(const char*, size_t, void*), void *putdat, int c, int n)
+{
+	char pad[16];
+	int k;
+
+	if (n <= 0)
+		return;
+	k = MIN(n, (int) sizeof(pad));
+	memset(pad, c, k);
+	for (; n > 0; n -= k)
+		putbuf(pad, MIN(n, k), putdat);
+}
+
 /*
- * Print a number (base <= 16) in reverse order,
- * using specified putch function and associated pointer putdat.
+ * Print a number (base <= 16),
+ * using specified putbuf function and associated pointer putdat.
+ *
+ * The digits are produced right to left into a buffer.  Bases 8 and 16
+ * only need shifts and masks.  Decimal works on 32 bits at a time, two
+ * digits per division, since a 64-bit division on i386 is a call to
+ * libgcc: numbers above 32 bits are split into 9-digit chunks first.
  */
 static void
-printnum(void (*putch)(int, void*), void *putdat,
+printnum(void (*putbuf)(const char*, size_t, void*), void *putdat,
 	 unsigned long long num, unsigned base, int width, int padc)
 {
-	// first recursively print all preceding (more significant) digits
-	if (num >= base) {
-		printnum(putch, putdat, num / base, base, width - 1, padc);
+	char buf[64];	// enough for 64 bits in base 2
+	char *p, *chunk;
+	unsigned long long q;
+	unsigned shift;
+
+	p = buf + sizeof(buf);
+	if (base == 16 || base == 8) {
+		shift = (base == 16 ? 4 : 3);
+		do {
+			*--p = digits[num & (base - 1)];
+			num >>= shift;
+		} while (num);
+	} else if (base == 10) {
+		while (num > 0xFFFFFFFFU) {
+			q = num / 1000000000;
+			// exactly 9 digits, with leading zeros
+			chunk = p - 9;
+			p = utoa10(p, num - q * 1000000000);
+			while (p > chunk)
+				*--p = '0';
+			num = q;
+		}
+		p = utoa10(p, num);
+	} else if (num <= 0xFFFFFFFFU) {
+		uint32_t n = num;
+
+		do {
+			*--p = digits[n % base];
+			n /= base;
+		} while (n);
 	} else {
-		// print any needed pad characters before first digit
-		while (--width > 0)
-			putch(padc, putdat);
+		do {
+			*--p = digits[num % base];
+			num /= base;
+		} while (num);
 	}
 
-	// then print this (the least significant) digit
-	putch("0123456789abcdef"[num % base], putdat);
+	// print any needed pad characters before first digit
+	putpad(putbuf, putdat, padc, width - (buf + sizeof(buf) - p));
+	putbuf(p, buf + sizeof(buf) - p, putdat);
 }
 
 // Get an unsigned int of various possible sizes from a varargs list,
@@ -76,24 +163,122 @@ getint(va_list *ap, int lflag)
 }
 
 
-// Main function to format and print a string.
-void printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...);
+static void printfmt_buf(void (*putbuf)(const char*, size_t, void*), void *putdat, const char *fmt, ...);
 
-void
-vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list ap)
+// Output one conversion, described by 'sp', 'width' and 'precision',
+// taking its argument from 'ap'.
+static void
+convert(void (*putbuf)(const char*, size_t, void*), void *putdat,
+	const struct fmtspec *sp, int width, int precision, va_list *ap)
 {
 	register const char *p;
-	register int ch, err;
+	register int err;
 	unsigned long long num;
-	int base, lflag, width, precision, altflag;
+	int base;
+	char padc = sp->padc, c;
+	size_t n;
+
+	switch (sp->conv) {
+
+	// character
+	case 'c':
+		c = va_arg(*ap, int);
+		putbuf(&c, 1, putdat);
+		break;
+
+	// error message
+	case 'e':
+		err = va_arg(*ap, int);
+		if (err < 0)
+			err = -err;
+		if (err >= MAXERROR || (p = error_string[err]) == NULL)
+			printfmt_buf(putbuf, putdat, "error %d", err);
+		else
+			printfmt_buf(putbuf, putdat, "%s", p);
+		break;
+
+	// string
+	case 's':
+		if ((p = va_arg(*ap, char *)) == NULL)
+			p = "(null)";
+		n = strnlen(p, precision);
+		if (padc != '-')
+			putpad(putbuf, putdat, padc, width - n);
+		if (!sp->altflag)
+			putbuf(p, n, putdat);
+		else
+			for (; n > 0; n--, p++) {
+				c = (*p < ' ' || *p > '~') ? '?' : *p;
+				putbuf(&c, 1, putdat);
+			}
+		if (padc == '-')
+			putpad(putbuf, putdat, ' ', width - n);
+		break;
+
+	// (signed) decimal
+	case 'd':
+		num = getint(ap, sp->lflag);
+		if ((long long) num < 0) {
+			putbuf("-", 1, putdat);
+			num = -(long long) num;
+		}
+		base = 10;
+		goto number;
+
+	// unsigned decimal
+	case 'u':
+		num = getuint(ap, sp->lflag);
+		base = 10;
+		goto number;
+
+	// (unsigned) octal
+	case 'o':
+		// Replace this with your code.
+		putbuf("XXX", 3, putdat);
+		break;
+
+	// pointer
+	case 'p':
+		putbuf("0x", 2, putdat);
+		num = (unsigned long long)
+			(uintptr_t) va_arg(*ap, void *);
+		base = 16;
+		goto number;
+
+	// (unsigned) hexadecimal
+	case 'x':
+		num = getuint(ap, sp->lflag);
+		base = 16;
+	number:
+		printnum(putbuf, putdat, num, base, width, padc);
+		break;
+
+	// escaped '%' character
+	case '%':
+		putbuf("%", 1, putdat);
+		break;
+	}
+}
+
+// Main function to format and print a string.
+// Format 'fmt', passing the output to 'putbuf' in spans: each run of
+// literal text and each conversion is one call where possible.
+void
+vprintfmt_buf(void (*putbuf)(const char*, size_t, void*), void *putdat, const char *fmt, va_list ap)
+{
+	register const char *p;
+	register int ch;
+	int lflag, width, precision, altflag;
 	char padc;
+	struct fmtspec spec;
 
 	while (1) {
-		while ((ch = *(unsigned char *) fmt++) != '%') {
-			if (ch == '\0')
-				return;
-			putch(ch, putdat);
-		}
+		for (p = fmt; *fmt != '%' && *fmt != '\0'; fmt++)
+			/* do nothing */;
+		if (fmt > p)
+			putbuf(p, fmt - p, putdat);
+		if (*fmt++ == '\0')
+			return;
 
 		// Process a %-escape sequence
 		padc = ' ';
@@ -155,87 +340,26 @@ vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list ap)
 			lflag++;
 			goto reswitch;
 
-		// character
+		// conversions
 		case 'c':
-			putch(va_arg(ap, int), putdat);
-			break;
-
-		// error message
 		case 'e':
-			err = va_arg(ap, int);
-			if (err < 0)
-				err = -err;
-			if (err >= MAXERROR || (p = error_string[err]) == NULL)
-				printfmt(putch, putdat, "error %d", err);
-			else
-				printfmt(putch, putdat, "%s", p);
-			break;
-
-		// string
 		case 's':
-			if ((p = va_arg(ap, char *)) == NULL)
-				p = "(null)";
-			if (width > 0 && padc != '-')
-				for (width -= strnlen(p, precision); width > 0; width--)
-					putch(padc, putdat);
-			for (; (ch = *p++) != '\0' && (precision < 0 || --precision >= 0); width--)
-				if (altflag && (ch < ' ' || ch > '~'))
-					putch('?', putdat);
-				else
-					putch(ch, putdat);
-			for (; width > 0; width--)
-				putch(' ', putdat);
-			break;
-
-		// (signed) decimal
 		case 'd':
-			num = getint(&ap, lflag);
-			if ((long long) num < 0) {
-				putch('-', putdat);
-				num = -(long long) num;
-			}
-			base = 10;
-			goto number;
-
-		// unsigned decimal
 		case 'u':
-			num = getuint(&ap, lflag);
-			base = 10;
-			goto number;
-
-		// (unsigned) octal
 		case 'o':
-			// Replace this with your code.
-			putch('X', putdat);
-			putch('X', putdat);
-			putch('X', putdat);
-			break;
-
-		// pointer
 		case 'p':
-			putch('0', putdat);
-			putch('x', putdat);
-			num = (unsigned long long)
-				(uintptr_t) va_arg(ap, void *);
-			base = 16;
-			goto number;
-
-		// (unsigned) hexadecimal
 		case 'x':
-			num = getuint(&ap, lflag);
-			base = 16;
-		number:
-			printnum(putch, putdat, num, base, width, padc);
-			break;
-
-		// escaped '%' character
 		case '%':
-			putch(ch, putdat);
+			spec.conv = ch;
+			spec.padc = padc;
+			spec.lflag = lflag;
+			spec.altflag = altflag;
+			convert(putbuf, putdat, &spec, width, precision, &ap);
 			break;
 
 		// unrecognized escape sequence - just print it literally
 		default:
-			putch('%', putdat);
+			putbuf("%", 1, putdat);
 			for (fmt--; fmt[-1] != '%'; fmt--)
 				/* do nothing */;
 			break;
@@ -243,6 +367,169 @@ vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list ap)
 	}
 }
 
+// Compile 'fmt' into 'd', so that vprintfmt_desc() can format it
+// without parsing it again.  This follows the same state machine as
+// vprintfmt_buf(), so the output is the same.  Formats it can't
+// describe -- more than FMTDESC_NSPEC conversions, literal runs over
+// 65535 bytes, unknown conversions, or a '*' followed by anything that
+// depends on its value -- are marked with nspec = -1; the caller
+// should use vprintfmt_buf() then.
+// Returns 0 on success, -E_INVAL on failure.
+int
+fmt_compile(struct fmtdesc *d, const char *fmt)
+{
+	struct fmtspec *sp;
+	const char *lit;
+	int ch, width, precision, n;
+
+	d->fmt = fmt;
+	d->nspec = -1;
+	for (n = 0; n <= FMTDESC_NSPEC; n++) {
+		sp = &d->spec[n];
+		for (lit = fmt; *fmt != '%' && *fmt != '\0'; fmt++)
+			/* do nothing */;
+		// Longer literal runs don't fit in litlen.
+		if (fmt - lit > 0xFFFF)
+			return -E_INVAL;
+		sp->lit = lit;
+		sp->litlen = fmt - lit;
+		if (*fmt++ == '\0') {
+			sp->conv = 0;
+			d->nspec = n + 1;
+			return 0;
+		}
+
+		sp->padc = ' ';
+		sp->lflag = 0;
+		sp->altflag = 0;
+		sp->star = FMT_STAR_NONE;
+		width = -1;
+		precision = -1;
+		for (;;) {
+			ch = *(unsigned char *) fmt++;
+			// After a '*', whether width is negative is only
+			// known at run time.
+			if (sp->star != FMT_STAR_NONE
+			    && (ch == '.' || (ch >= '1' && ch <= '9') || ch == '*'))
+				return -E_INVAL;
+			switch (ch) {
+			case '-':
+				sp->padc = '-';
+				continue;
+			case '0':
+				sp->padc = '0';
+				continue;
+			case '1':
+			case '2':
+			case '3':
+			case '4':
+			case '5':
+			case '6':
+			case '7':
+			case '8':
+			case '9':
+				for (precision = 0; ; ++fmt) {
+					precision = precision * 10 + ch - '0';
+					ch = *fmt;
+					if (ch < '0' || ch > '9')
+						break;
+				}
+				if (width < 0)
+					width = precision, precision = -1;
+				continue;
+			case '*':
+				if (width < 0)
+					sp->star = FMT_STAR_WIDTH;
+				else
+					sp->star = FMT_STAR_PRECISION;
+				continue;
+			case '.':
+				if (width < 0)
+					width = 0;
+				continue;
+			case '#':
+				sp->altflag = 1;
+				continue;
+			case 'l':
+				sp->lflag++;
+				continue;
+			case 'c':
+			case 'e':
+			case 's':
+			case 'd':
+			case 'u':
+			case 'o':
+			case 'p':
+			case 'x':
+			case '%':
+				break;
+			default:
+				return -E_INVAL;
+			}
+			break;
+		}
+		sp->conv = ch;
+		sp->width = width;
+		sp->precision = precision;
+	}
+	return -E_INVAL;
+}
+
+// Format the arguments in 'ap' as described by 'd', which
+// fmt_compile() must have compiled successfully.
+void
+vprintfmt_desc(void (*putbuf)(const char*, size_t, void*), void *putdat, const struct fmtdesc *d, va_list ap)
+{
+	const struct fmtspec *sp;
+	int width, precision;
+
+	for (sp = d->spec; ; sp++) {
+		if (sp->litlen)
+			putbuf(sp->lit, sp->litlen, putdat);
+		if (!sp->conv)
+			return;
+		width = sp->width;
+		precision = sp->precision;
+		if (sp->star == FMT_STAR_WIDTH)
+			width = va_arg(ap, int);
+		else if (sp->star == FMT_STAR_PRECISION)
+			precision = va_arg(ap, int);
+		convert(putbuf, putdat, sp, width, precision, &ap);
+	}
+}
+
+static void
+printfmt_buf(void (*putbuf)(const char*, size_t, void*), void *putdat, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	vprintfmt_buf(putbuf, putdat, fmt, ap);
+	va_end(ap);
+}
+
+// vprintfmt() passes one character at a time to its putch function,
+// through this adapter.
+struct putchbuf {
+	void (*putch)(int, void*);
+	void *putdat;
+};
+
+static void
+putch_span(const char *buf, size_t n, struct putchbuf *b)
+{
+	for (; n > 0; n--)
+		b->putch(*buf++, b->putdat);
+}
+
+void
+vprintfmt(void (*putch)(int, void*), void *putdat, const char *fmt, va_list ap)
+{
+	struct putchbuf b = {putch, putdat};
+
+	vprintfmt_buf((void*)putch_span, &b, fmt, ap);
+}
+
 void
 printfmt(void (*putch)(int, void*), void *putdat, const char *fmt, ...)
 {
@@ -260,11 +547,13 @@ struct sprintbuf {
 };
 
 static void
-sprintputch(int ch, struct sprintbuf *b)
+sprintputbuf(const char *s, size_t n, struct sprintbuf *b)
 {
-	b->cnt++;
-	if (b->buf < b->ebuf)
-		*b->buf++ = ch;
+	size_t k = MIN(n, (size_t) (b->ebuf - b->buf));
+
+	b->cnt += n;
+	memcpy(b->buf, s, k);
+	b->buf += k;
 }
 
 int
@@ -276,7 +565,7 @@ vsnprintf(char *buf, int n, const char *fmt, va_list ap)
 		return -E_INVAL;
 
 	// print the string to the buffer
-	vprintfmt((void*)sprintputch, &b, fmt, ap);
+	vprintfmt_buf((void*)sprintputbuf, &b, fmt, ap);
 
 	// null terminate the buffer
 	*b.buf = '\0';
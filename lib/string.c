@@ -1,6 +1,9 @@
 // Basic string routines.  Not hardware optimized, but not shabby.
 
 #include <inc/string.h>
+#include <inc/cpuid.h>
+#include <inc/mmu.h>
+#include <inc/x86.h>
 
 // Using assembly for memset/memmove
 // makes some difference on real hardware,
@@ -8,24 +11,51 @@
 // Primespipe runs 3x faster this way.
 #define ASM 1
 
+// Word-at-a-time scanning.  The scans below read whole aligned words,
+// possibly past the end of the string, but an aligned word never
+// straddles a page boundary, so they never touch a page the string
+// doesn't.  HASZERO(w) is nonzero iff some byte of 'w' is zero.
+typedef uint32_t __attribute__((__may_alias__)) word_t;
+
+#define ONES		0x01010101U
+#define HIGHS		0x80808080U
+#define HASZERO(w)	(((w) - ONES) & ~(w) & HIGHS)
+#define ALIGNED(p)	(((uintptr_t) (p) & (sizeof(word_t) - 1)) == 0)
+
 int
 strlen(const char *s)
 {
-	int n;
+	const char *p;
+	const word_t *w;
 
-	for (n = 0; *s != '\0'; s++)
-		n++;
-	return n;
+	for (p = s; !ALIGNED(p); p++)
+		if (*p == '\0')
+			return p - s;
+	for (w = (const word_t *) p; !HASZERO(*w); w++)
+		/* do nothing */;
+	for (p = (const char *) w; *p != '\0'; p++)
+		/* do nothing */;
+	return p - s;
 }
 
 int
 strnlen(const char *s, size_t size)
 {
-	int n;
-
-	for (n = 0; size > 0 && *s != '\0'; s++, size--)
-		n++;
-	return n;
+	const char *p, *end;
+	const word_t *w;
+
+	end = s + size;
+	if (end < s)
+		end = (const char *) ~(uintptr_t) 0;
+	for (p = s; p < end && !ALIGNED(p); p++)
+		if (*p == '\0')
+			return p - s;
+	for (w = (const word_t *) p;
+	     (const char *) (w + 1) <= end && !HASZERO(*w); w++)
+		/* do nothing */;
+	for (p = (const char *) w; p < end && *p != '\0'; p++)
+		/* do nothing */;
+	return p - s;
 }
 
 char *
@@ -95,12 +125,28 @@ strncmp(const char *p, const char *q, size_t n)
 		return (int) ((unsigned char) *p - (unsigned char) *q);
 }
 
+// Skip 's' ahead to the word holding the first 'c' or NUL.
+static const char *
+strchr_words(const char *s, char c)
+{
+	const word_t *w;
+	uint32_t cc;
+
+	for (; !ALIGNED(s); s++)
+		if (*s == c || *s == '\0')
+			return s;
+	cc = (unsigned char) c * ONES;
+	for (w = (const word_t *) s; !HASZERO(*w) && !HASZERO(*w ^ cc); w++)
+		/* do nothing */;
+	return (const char *) w;
+}
+
 // Return a pointer to the first occurrence of 'c' in 's',
 // or a null pointer if the string has no 'c'.
 char *
 strchr(const char *s, char c)
 {
-	for (; *s; s++)
+	for (s = strchr_words(s, c); *s; s++)
 		if (*s == c)
 			return (char *) s;
 	return 0;
@@ -111,31 +157,192 @@ strchr(const char *s, char c)
 char *
 strfind(const char *s, char c)
 {
-	for (; *s; s++)
+	for (s = strchr_words(s, c); *s; s++)
 		if (*s == c)
 			break;
 	return (char *) s;
 }
 
 #if ASM
+// Forward 'rep' string operations.  Each advances the pointers past
+// what it did.  DF is always clear outside of memmove's backward copy.
+static inline void
+rep_movsb(char **d, const char **s, size_t n)
+{
+	asm volatile("rep movsb"
+		: "+D" (*d), "+S" (*s), "+c" (n) : : "memory");
+}
+
+static inline void
+rep_movsl(char **d, const char **s, size_t n)
+{
+	asm volatile("rep movsl"
+		: "+D" (*d), "+S" (*s), "+c" (n) : : "memory");
+}
+
+static inline void
+rep_stosb(char **d, int c, size_t n)
+{
+	asm volatile("rep stosb"
+		: "+D" (*d), "+c" (n) : "a" (c) : "memory");
+}
+
+static inline void
+rep_stosl(char **d, uint32_t c, size_t n)
+{
+	asm volatile("rep stosl"
+		: "+D" (*d), "+c" (n) : "a" (c) : "memory");
+}
+
+// Copy 'n' 64-byte blocks from 's' to 16-byte aligned 'd' through the
+// SSE registers, storing with 'store'.  The SSE registers aren't saved
+// on interrupts, which is fine as long as interrupt handlers don't
+// copy with SSE while it is in use -- the kernel only takes interrupts
+// when idle.  Compilers that can't use the SSE registers won't take
+// them as clobbers either.
+#ifdef __SSE__
+#define SSE2_CLOBBERS	"xmm0", "xmm1", "xmm2", "xmm3",
+#else
+#define SSE2_CLOBBERS
+#endif
+
+#define SSE2_COPY(d, s, n, store)					\
+	asm volatile("1:	movdqu 0(%1), %%xmm0\n"		\
+		     "	movdqu 16(%1), %%xmm1\n"			\
+		     "	movdqu 32(%1), %%xmm2\n"			\
+		     "	movdqu 48(%1), %%xmm3\n"			\
+		     "	" store " %%xmm0, 0(%0)\n"			\
+		     "	" store " %%xmm1, 16(%0)\n"			\
+		     "	" store " %%xmm2, 32(%0)\n"			\
+		     "	" store " %%xmm3, 48(%0)\n"			\
+		     "	addl $64, %1\n"				\
+		     "	addl $64, %0\n"				\
+		     "	decl %2\n"					\
+		     "	jnz 1b\n"					\
+		     : "+r" (d), "+r" (s), "+r" (n)			\
+		     : : SSE2_CLOBBERS "cc", "memory")
+
+// Copies at least this big bypass the cache with non-temporal stores;
+// they would only evict everything else from it.
+#define MEMCPY_NT_MIN	(256 * 1024)
+
+// Align the destination with a byte copy, copy the body a word at a
+// time, and copy the tail with another byte copy.  Short copies aren't
+// worth splitting.
+static void *
+memcpy_movsl(void *dst, const void *src, size_t n)
+{
+	const char *s = src;
+	char *d = dst;
+	size_t head;
+
+	if (n >= 16) {
+		head = -(uintptr_t) d & 3;
+		rep_movsb(&d, &s, head);
+		n -= head;
+		rep_movsl(&d, &s, n / 4);
+		n %= 4;
+	}
+	rep_movsb(&d, &s, n);
+	return dst;
+}
+
+// With Enhanced REP MOVSB/STOSB (ERMS), the microcode does all of
+// that itself, faster.
+static void *
+memcpy_erms(void *dst, const void *src, size_t n)
+{
+	const char *s = src;
+	char *d = dst;
+
+	rep_movsb(&d, &s, n);
+	return dst;
+}
+
+static void *
+memcpy_sse2(void *dst, const void *src, size_t n)
+{
+	const char *s = src;
+	char *d = dst;
+	size_t head, blocks;
+
+	// At least one whole block must be left after the head.
+	if (n >= 64 + 15) {
+		head = -(uintptr_t) d & 15;
+		rep_movsb(&d, &s, head);
+		n -= head;
+		blocks = n / 64;
+		n %= 64;
+		if (blocks * 64 >= MEMCPY_NT_MIN) {
+			SSE2_COPY(d, s, blocks, "movntdq");
+			asm volatile("sfence" : : : "memory");
+		} else
+			SSE2_COPY(d, s, blocks, "movdqa");
+	}
+	rep_movsb(&d, &s, n);
+	return dst;
+}
+
+static void *
+memset_stosl(void *v, int c, size_t n)
+{
+	char *p = v;
+	size_t head;
+
+	c &= 0xFF;
+	if (n >= 16) {
+		head = -(uintptr_t) p & 3;
+		rep_stosb(&p, c, head);
+		n -= head;
+		rep_stosl(&p, c * 0x01010101U, n / 4);
+		n %= 4;
+	}
+	rep_stosb(&p, c, n);
+	return v;
+}
+
+static void *
+memset_erms(void *v, int c, size_t n)
+{
+	char *p = v;
+
+	rep_stosb(&p, c, n);
+	return v;
+}
+
+// The variants in use, chosen by string_init().  All of them copy
+// forward, so memmove can use memcpy_impl whenever dst < src.
+static void *(*memcpy_impl)(void *, const void *, size_t) = memcpy_movsl;
+static void *(*memset_impl)(void *, int, size_t) = memset_stosl;
+
+// Pick the fastest memcpy and memset for this CPU.  In the kernel, the
+// SSE2 variant is only chosen if SSE is enabled (CR4.OSFXSR), so the
+// caller must enable it first if the CPU has SSE2.  Elsewhere (see
+// bench/), the OS has enabled it.
+void
+string_init(void)
+{
+	if (cpuid_has_feature(CPUID_FEATURE_ERMS)) {
+		memcpy_impl = memcpy_erms;
+		memset_impl = memset_erms;
+	} else if (cpuid_has_feature(CPUID_FEATURE_SSE2)
+#ifdef JOS_KERNEL
+		   && (rcr4() & CR4_OSFXSR)
+#endif
+		   )
+		memcpy_impl = memcpy_sse2;
+}
+
 void *
 memset(void *v, int c, size_t n)
 {
-	char *p;
+	return memset_impl(v, c, n);
+}
 
-	if (n == 0)
-		return v;
-	if ((int)v%4 == 0 && n%4 == 0) {
-		c &= 0xFF;
-		c = (c<<24)|(c<<16)|(c<<8)|c;
-		asm volatile("cld; rep stosl\n"
-			:: "D" (v), "a" (c), "c" (n/4)
-			: "cc", "memory");
-	} else
-		asm volatile("cld; rep stosb\n"
-			:: "D" (v), "a" (c), "c" (n)
-			: "cc", "memory");
-	return v;
+void *
+memcpy(void *dst, const void *src, size_t n)
+{
+	return memcpy_impl(dst, src, n);
 }
 
 void *
@@ -143,28 +350,36 @@ memmove(void *dst, const void *src, size_t n)
 {
 	const char *s;
 	char *d;
+	size_t tail;
 
 	s = src;
 	d = dst;
-	if (s < d && s + n > d) {
-		s += n;
-		d += n;
-		if ((int)s%4 == 0 && (int)d%4 == 0 && n%4 == 0)
-			asm volatile("std; rep movsl\n"
-				:: "D" (d-4), "S" (s-4), "c" (n/4) : "cc", "memory");
-		else
-			asm volatile("std; rep movsb\n"
-				:: "D" (d-1), "S" (s-1), "c" (n) : "cc", "memory");
-		// Some versions of GCC rely on DF being clear
-		asm volatile("cld" ::: "cc");
-	} else {
-		if ((int)s%4 == 0 && (int)d%4 == 0 && n%4 == 0)
-			asm volatile("cld; rep movsl\n"
-				:: "D" (d), "S" (s), "c" (n/4) : "cc", "memory");
-		else
-			asm volatile("cld; rep movsb\n"
-				:: "D" (d), "S" (s), "c" (n) : "cc", "memory");
+	if (!(s < d && s + n > d))
+		return memcpy_impl(dst, src, n);
+
+	// Copy backward, aligning the end of the destination.  The
+	// pointers start at the last byte, and end one byte before
+	// the first.
+	s += n - 1;
+	d += n - 1;
+	if (n >= 16) {
+		tail = ((uintptr_t) d + 1) & 3;
+		n -= tail;
+		asm volatile("std; rep movsb\n"
+			: "+D" (d), "+S" (s), "+c" (tail) : : "cc", "memory");
+		s -= 3;
+		d -= 3;
+		tail = n / 4;
+		n %= 4;
+		asm volatile("std; rep movsl\n"
+			: "+D" (d), "+S" (s), "+c" (tail) : : "cc", "memory");
+		s += 3;
+		d += 3;
 	}
+	asm volatile("std; rep movsb\n"
+		: "+D" (d), "+S" (s), "+c" (n) : : "cc", "memory");
+	// Some versions of GCC rely on DF being clear
+	asm volatile("cld" ::: "cc");
 	return dst;
 }
 
@@ -203,7 +418,6 @@ memmove(void *dst, const void *src, size_t n)
 
 	return dst;
 }
-#endif
 
 void *
 memcpy(void *dst, const void *src, size_t n)
@@ -211,12 +425,25 @@ memcpy(void *dst, const void *src, size_t n)
 	return memmove(dst, src, n);
 }
 
+void
+string_init(void)
+{
+}
+#endif
+
+// memcmp and memfind know how much they may read, so they use
+// unaligned words, which x86 handles fine.
 int
 memcmp(const void *v1, const void *v2, size_t n)
 {
 	const uint8_t *s1 = (const uint8_t *) v1;
 	const uint8_t *s2 = (const uint8_t *) v2;
 
+	for (; n >= sizeof(word_t); n -= sizeof(word_t)) {
+		if (*(const word_t *) s1 != *(const word_t *) s2)
+			break;
+		s1 += sizeof(word_t), s2 += sizeof(word_t);
+	}
 	while (n-- > 0) {
 		if (*s1 != *s2)
 			return (int) *s1 - (int) *s2;
@@ -230,6 +457,13 @@ void *
 memfind(const void *s, int c, size_t n)
 {
 	const void *ends = (const char *) s + n;
+	uint32_t cc = (unsigned char) c * ONES;
+
+	for (; n >= sizeof(word_t); n -= sizeof(word_t)) {
+		if (HASZERO(*(const word_t *) s ^ cc))
+			break;
+		s = (const char *) s + sizeof(word_t);
+	}
 	for (; s < ends; s++)
 		if (*(const unsigned char *) s == (unsigned char) c)
 			break;
@@ -0,0 +1,150 @@
+#!/usr/bin/env python
+
+"""Decode a JOS 'tracedump' into Chrome trace-event JSON.
+
+Capture the serial output of a run that ends with 'tracedump', e.g.
+with QEMUEXTRA='-serial file:serial.log' or by saving 'make qemu-nox'
+output, then
+
+    ./tracedecode.py serial.log > trace.json
+
+and load trace.json in chrome://tracing or https://ui.perfetto.dev.
+Anything between frames (ordinary console text) is ignored.  See
+klog_export() in kern/klog.c for the frame format."""
+
+from __future__ import print_function
+
+import sys, re, json, struct
+
+MAGIC = b"JTRC"
+TRACE_HEADER, TRACE_STRING, TRACE_RECORD, TRACE_END, TRACE_ARGSTR = 1, 2, 3, 4, 5
+
+def frames(data):
+    """Yield (type, payload) for each well-formed frame in data."""
+    pos = 0
+    while True:
+        pos = data.find(MAGIC, pos)
+        if pos < 0 or pos + 7 > len(data):
+            return
+        ftype, length = struct.unpack_from("<BH", data, pos + 4)
+        end = pos + 7 + length
+        if end + 1 > len(data):
+            return
+        payload = data[pos + 7:end]
+        if (sum(bytearray(payload)) + bytearray(data[end:end + 1])[0]) % 256:
+            # Not a frame after all, or a corrupted one; resync.
+            pos += 1
+            continue
+        yield ftype, payload
+        pos = end + 1
+
+FMT_RE = re.compile(r"%([-+ #0]*)(\*|[0-9]+)?(?:\.([0-9]+))?(l*)([a-zA-Z%])")
+
+def format_args(fmt, words, argstrs={}):
+    """Format like the kernel's vprintfmt, taking arguments from the
+    raw 32-bit argument words.  %s looks its pointer up in argstrs,
+    and shows the pointer if the dump didn't include the string."""
+    words = list(words)
+
+    def take(n=1):
+        v = 0
+        for i in range(n):
+            v |= (words.pop(0) if words else 0) << (32 * i)
+        return v
+
+    def conv(m):
+        flags, width, prec, lflag, c = m.groups()
+        if c == "%":
+            return "%"
+        if width == "*":
+            width = str(take())
+        n = 2 if len(lflag) >= 2 else 1
+        if c in "di":
+            v = take(n)
+            if v >> (32 * n - 1):
+                v -= 1 << (32 * n)
+            s = str(v)
+        elif c == "u":
+            s = str(take(n))
+        elif c in "xX":
+            s = "%x" % take(n)
+        elif c == "o":
+            s = "%o" % take(n)
+        elif c == "p":
+            s = "0x%08x" % take()
+        elif c == "c":
+            s = chr(take() & 0xff)
+        elif c == "s":
+            v = take()
+            s = argstrs.get(v, "<str@0x%08x>" % v)
+        else:
+            return m.group(0)
+        if width:
+            w = int(width)
+            if "-" in flags:
+                s = s.ljust(w)
+            else:
+                s = s.rjust(w, "0" if "0" in flags and c != "s" else " ")
+        return s
+
+    return FMT_RE.sub(conv, fmt)
+
+def decode(data):
+    khz = None
+    strings, argstrs = {}, {}
+    events = []
+    for ftype, payload in frames(data):
+        if ftype == TRACE_HEADER:
+            version, khz, ncpu = struct.unpack_from("<III", payload)
+            if version != 1:
+                raise ValueError("unknown trace version %d" % version)
+            strings, argstrs, events = {}, {}, []
+        elif ftype == TRACE_STRING:
+            sid, = struct.unpack_from("<H", payload)
+            strings[sid] = payload[2:].decode("latin-1")
+        elif ftype == TRACE_ARGSTR:
+            addr, = struct.unpack_from("<I", payload)
+            argstrs[addr] = payload[4:].decode("latin-1")
+        elif ftype == TRACE_RECORD:
+            tsc, cpu, nargs, event = struct.unpack_from("<QBBH", payload)
+            args = struct.unpack_from("<%dI" % nargs, payload, 12)
+            fmt = strings.get(event, "event %d" % event)
+            events.append({
+                "name": format_args(fmt, args, argstrs).strip(),
+                "cat": "klog",
+                "ph": "i",
+                "s": "t",
+                "ts": tsc * 1000.0 / khz if khz else tsc,
+                "pid": 0,
+                "tid": cpu,
+                "args": {"fmt": fmt, "words": ["0x%08x" % a for a in args]},
+            })
+        elif ftype == TRACE_END:
+            count, = struct.unpack_from("<I", payload)
+            if count != len(events):
+                print("warning: expected %d records, got %d"
+                      % (count, len(events)), file=sys.stderr)
+    if khz is None:
+        raise ValueError("no trace found")
+    return {"traceEvents": events, "displayTimeUnit": "ns",
+            "otherData": {"tsc_khz": khz}}
+
+def main():
+    if len(sys.argv) > 2:
+        print("Usage: %s [serial-log]" % sys.argv[0], file=sys.stderr)
+        sys.exit(2)
+    if len(sys.argv) == 2:
+        with open(sys.argv[1], "rb") as f:
+            data = f.read()
+    else:
+        data = getattr(sys.stdin, "buffer", sys.stdin).read()
+    try:
+        trace = decode(data)
+    except ValueError as e:
+        print("%s: %s" % (sys.argv[0], e), file=sys.stderr)
+        sys.exit(1)
+    json.dump(trace, sys.stdout, indent=1)
+    print()
+
+if __name__ == "__main__":
+    main()